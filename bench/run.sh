@@ -0,0 +1,40 @@
+#!/usr/bin/env bash
+# Compare two solarforth binaries on the benchmark corpus.
+#
+#   bench/run.sh BASE NEW [RUNS]
+#
+# Each workload runs RUNS times (default 5) per binary; the best wall time
+# is reported with the relative change of NEW against BASE. tcp_loopback
+# is bounded by a timer, so its time mostly reflects that timer.
+set -eu
+
+base=$1
+new=$2
+runs=${3:-5}
+dir=$(cd "$(dirname "$0")" && pwd)
+
+best_ms() {
+  local bin=$1 file=$2 best= t0 t1 ms
+  for _ in $(seq "$runs"); do
+    t0=$(date +%s%N)
+    "$bin" "$file" >/dev/null
+    t1=$(date +%s%N)
+    ms=$(((t1 - t0) / 1000000))
+    if [ -z "$best" ] || [ "$ms" -lt "$best" ]; then
+      best=$ms
+    fi
+  done
+  echo "$best"
+}
+
+printf '%-16s %10s %10s %8s\n' workload "base ms" "new ms" delta
+for f in "$dir"/*.frt; do
+  a=$(best_ms "$base" "$f")
+  b=$(best_ms "$new" "$f")
+  if [ "$a" -gt 0 ]; then
+    d=$(awk -v a="$a" -v b="$b" 'BEGIN { printf "%+.1f%%", (b - a) * 100 / a }')
+  else
+    d=n/a
+  fi
+  printf '%-16s %10s %10s %8s\n' "$(basename "$f" .frt)" "$a" "$b" "$d"
+done
@@ -0,0 +1,52 @@
+#!/usr/bin/env bash
+# Loopback echo benchmark: the same server on libuv and on io_uring.
+#
+#   bench/uring.sh [BIN] [RUNS]
+#
+# Each run starts bench/net/echo_server.frt, with and without --io-uring,
+# and loads it with bench/net/echo_clients.frt (always on libuv). The
+# server's best CPU time (user + system) over RUNS runs (default 5) is
+# reported for each backend; the work done is the same, so less is better.
+set -eu
+
+bin=${1:-./solarforth}
+runs=${2:-5}
+dir=$(cd "$(dirname "$0")" && pwd)
+
+# CPU milliseconds the server used while the clients ran.
+server_ms() {
+  local out
+  out=$(mktemp)
+  {
+    TIMEFORMAT='%U %S'
+    time "$bin" "$@" "$dir/net/echo_server.frt" >/dev/null
+  } 2>"$out" &
+  local server=$!
+  sleep 0.2
+  "$bin" "$dir/net/echo_clients.frt" >/dev/null
+  wait "$server"
+  awk 'NF == 2 { printf "%d\n", ($1 + $2) * 1000 }' "$out"
+  grep -v '^[0-9.]* [0-9.]*$' "$out" >&2 || true
+  rm -f "$out"
+}
+
+best_ms() {
+  local best= ms
+  for _ in $(seq "$runs"); do
+    ms=$(server_ms "$@")
+    if [ -z "$best" ] || [ "$ms" -lt "$best" ]; then
+      best=$ms
+    fi
+  done
+  echo "$best"
+}
+
+a=$(best_ms)
+b=$(best_ms --io-uring)
+if [ "$a" -gt 0 ]; then
+  d=$(awk -v a="$a" -v b="$b" 'BEGIN { printf "%+.1f%%", (b - a) * 100 / a }')
+else
+  d=n/a
+fi
+printf '%-16s %10s %10s %8s\n' backend "libuv ms" "uring ms" delta
+printf '%-16s %10s %10s %8s\n' "echo server cpu" "$a" "$b" "$d"
@@ -0,0 +1,59 @@
+/*
+A native extension module for load-native.
+
+  make examples/strutil.so
+  ./solarforth examples/native.frt
+
+Everything goes through the SfNativeApi table handed to sf_native_init, so
+this builds against src/solarforth.h alone.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "solarforth.h"
+
+static const SfNativeApi *sf;
+
+// upcase ( str -- str )
+static void prim_upcase(SfContext *ctx) {
+  char *s;
+  if (sf->pop_str(ctx, &s) != SF_OK)
+    sf->fail(ctx, SF_ERR_TYPE, "upcase: expected string");
+  for (char *p = s; *p; p++)
+    *p = (char)toupper((unsigned char)*p);
+  sf->push_str(ctx, s);
+  free(s);
+}
+
+// repeat ( str n -- str )
+static void prim_repeat(SfContext *ctx) {
+  int64_t n;
+  char *s;
+  if (sf->pop_int(ctx, &n) != SF_OK || sf->pop_str(ctx, &s) != SF_OK)
+    sf->fail(ctx, SF_ERR_TYPE, "repeat: expected str n");
+  size_t len = strlen(s);
+  char *out = malloc(len * (size_t)(n > 0 ? n : 0) + 1);
+  if (!out) {
+    free(s);
+    sf->fail(ctx, SF_ERR_HOST, "repeat: out of memory");
+  }
+  char *p = out;
+  for (int64_t i = 0; i < n; i++, p += len)
+    memcpy(p, s, len);
+  *p = '\0';
+  sf->push_str(ctx, out);
+  free(out);
+  free(s);
+}
+
+int sf_native_init(SfContext *ctx, const SfNativeApi *api) {
+  if (api->abi != SF_NATIVE_ABI || api->size < sizeof(SfNativeApi))
+    return SF_ERR_NATIVE;
+  sf = api;
+  api->register_prim(ctx, "upcase", prim_upcase);
+  api->register_prim(ctx, "repeat", prim_repeat);
+  return SF_OK;
+}
@@ -0,0 +1,138 @@
+/*
+solarforth command-line driver
+
+  solarforth [--sim] [--watch] [--io-uring] [--workers N] [script.frt ...]
+
+Runs each script named on the command line in order, or an interactive
+prompt on the event loop when none is given. With --workers, N worker
+processes run the scripts under a supervising master (src/prefork.c). The
+interpreter itself is libsolarforth (src/solarforth.c).
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "prefork.h"
+#include "solarforth.h"
+
+// Errors from callbacks at the prompt are reported like a line's errors.
+static void report(SfContext *ctx, int status, const char *msg, void *data) {
+  (void)ctx;
+  (void)status;
+  (void)data;
+  fprintf(stderr, "%s\n", msg);
+}
+
+// The prompt when no scripts are given. It normally reads stdin as a handle
+// on the loop, so timers and sockets started at the prompt keep running
+// while it waits; errors are reported and the session carries on. Input
+// redirected from a file (or --sim) falls back to reading it line by line.
+static void repl_blocking(SfContext *ctx) {
+  char *line = NULL;
+  size_t n = 0;
+  while (sf_running(ctx)) {
+    printf("> ");
+    fflush(stdout);
+    ssize_t r = getline(&line, &n, stdin);
+    if (r <= 0)
+      break;
+    if (sf_eval(ctx, line) != SF_OK)
+      fprintf(stderr, "%s\n", sf_error(ctx));
+  }
+  free(line);
+}
+
+// The worker command line: this one without --workers N.
+static char **worker_argv(int argc, char **argv) {
+  char **args = calloc((size_t)argc + 1, sizeof(char *));
+  int n = 0;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "--workers") == 0)
+      i++;
+    else
+      args[n++] = argv[i];
+  }
+  return args;
+}
+
+int main(int argc, char **argv) {
+  SfContext *ctx = sf_context_new(uv_default_loop());
+  int status = 0;
+  int first = 1;
+  int watch = 0;
+  int sim = 0;
+  int uring = 0;
+  long workers = 0;
+
+  for (; first < argc && strncmp(argv[first], "--", 2) == 0; first++) {
+    if (strcmp(argv[first], "--sim") == 0) {
+      // Virtual clock and in-memory loopback TCP (see sf_simulate).
+      sf_simulate(ctx);
+      sim = 1;
+    } else if (strcmp(argv[first], "--watch") == 0) {
+      // Reload each script's definitions when it changes (see sf_watch).
+      watch = 1;
+    } else if (strcmp(argv[first], "--io-uring") == 0) {
+      // TCP on io_uring where the kernel has it (see sf_use_io_uring).
+      uring = 1;
+    } else if (strcmp(argv[first], "--workers") == 0 && first + 1 < argc) {
+      // Run the scripts in N supervised processes (see prefork.c).
+      char *end;
+      workers = strtol(argv[++first], &end, 10);
+      if (*end || workers < 1 || workers > 1024) {
+        fprintf(stderr, "--workers: expected a count, got %s\n", argv[first]);
+        sf_context_free(ctx);
+        return 2;
+      }
+    } else {
+      fprintf(stderr, "unknown option: %s\n", argv[first]);
+      sf_context_free(ctx);
+      return 2;
+    }
+  }
+
+  if (workers) {
+    sf_context_free(ctx);
+    if (sim || argc == first) {
+      fprintf(stderr, "--workers: needs scripts, and cannot be simulated\n");
+      return 2;
+    }
+    char **args = worker_argv(argc, argv);
+    status = prefork_run((int)workers, args);
+    free(args);
+    return status;
+  }
+
+  if (uring && sf_use_io_uring(ctx) != SF_OK)
+    fprintf(stderr, "%s; using libuv\n", sf_error(ctx));
+
+  // Started by a --workers master: listeners come from it.
+  const char *fd = getenv("SOLARFORTH_WORKER_FD");
+  if (fd && sf_worker_attach(ctx, atoi(fd)) != SF_OK) {
+    fprintf(stderr, "%s\n", sf_error(ctx));
+    sf_context_free(ctx);
+    return 1;
+  }
+
+  if (argc > first) {
+    for (int i = first; i < argc; i++) {
+      if ((watch && sf_watch(ctx, argv[i]) != SF_OK) ||
+          sf_eval_file(ctx, argv[i]) != SF_OK) {
+        fprintf(stderr, "%s\n", sf_error(ctx));
+        status = 1;
+        break;
+      }
+    }
+  } else if (sf_repl_stdio(ctx) == SF_OK) {
+    sf_set_error_handler(ctx, report, NULL);
+    sf_run(ctx);
+  } else {
+    repl_blocking(ctx);
+  }
+
+  sf_context_free(ctx);
+  return status;
+}
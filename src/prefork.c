@@ -0,0 +1,411 @@
+/*
+prefork master for `solarforth --workers N script.frt ...`
+
+The master runs no script itself. It starts N copies of this binary on the
+same command line, each with an IPC pipe on fd 3 (named by
+SOLARFORTH_WORKER_FD, see sf_worker_attach), and answers their requests,
+one line each:
+
+  bind <ip> <port>    bind the address, once for all workers, and pass the
+                      socket back with uv_write2 ("ok"), or "err <message>"
+  stats <bytes> <peak> <cpu-ns> <handles> <out-dropped> <log-records>
+        <log-dropped> <lag-ms> <conn-rejected> <stack-reclaimed>
+                      the worker's sf_stats, sent once a second
+
+Every worker listens on the same socket, so the kernel spreads connections
+across them, and a crash takes down one worker's connections only. A worker
+that crashes or exits with an error is started again, a second later if it
+ran for less than that; one that exits cleanly is not. After RESTART_LIMIT
+such short runs in a row the worker is left down. The master exits with 1
+if any worker's last run failed, else 0.
+SIGTERM and SIGINT are passed on and the master exits once the workers are
+gone (scripts using signal:defaults drain first); SIGHUP is passed on;
+SIGUSR1 writes each worker's last stats and their totals to stderr.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "prefork.h"
+#include "solarforth.h"
+
+#define WORKER_FD 3
+#define RESTART_DELAY_MS 1000
+#define RESTART_LIMIT 5 // failed runs in a row, each shorter than the delay
+
+// A socket bound for the workers, kept for the ones started later.
+typedef struct Listener {
+  struct Listener *next;
+  char addr[80]; // "<ip> <port>" as requested
+  uv_tcp_t tcp;
+} Listener;
+
+typedef struct Master Master;
+
+typedef struct Child {
+  Master *m;
+  int slot;
+  uv_process_t proc;
+  uv_pipe_t ipc;
+  uv_timer_t restart;
+  bool alive;
+  uint64_t started; // loop time of the last start
+  unsigned restarts;
+  unsigned quick; // failed runs in a row shorter than RESTART_DELAY_MS
+  bool failed;    // the last run crashed, exited with an error or never began
+  SfStats stats; // as last reported
+  char in[512];  // partial request line
+  size_t len;
+} Child;
+
+struct Master {
+  uv_loop_t *loop;
+  char **argv; // worker command line
+  char exe[4096];
+  Child *child;
+  int n;
+  int alive;
+  Listener *listeners;
+  uv_signal_t sig[4];
+  bool stopping;
+};
+
+static void spawn(Child *c);
+
+static void on_reply_written(uv_write_t *req, int status) {
+  (void)status;
+  free(req);
+}
+
+static void reply(Child *c, const char *msg, uv_tcp_t *send) {
+  // The request and its text go together; msg is copied in behind it.
+  size_t n = strlen(msg);
+  uv_write_t *req = malloc(sizeof(uv_write_t) + n);
+  if (!req) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  char *text = (char *)(req + 1);
+  memcpy(text, msg, n);
+  uv_buf_t buf = uv_buf_init(text, (unsigned)n);
+  int rc = send ? uv_write2(req, (uv_stream_t *)&c->ipc, &buf, 1,
+                            (uv_stream_t *)send, on_reply_written)
+                : uv_write(req, (uv_stream_t *)&c->ipc, &buf, 1,
+                           on_reply_written);
+  if (rc)
+    free(req);
+}
+
+// Bind with the socket API rather than uv_tcp_bind, which defers errors
+// like EADDRINUSE to the listen() that only the workers will call.
+static int listener_bind(Master *m, const char *ip, int port, Listener **out) {
+  struct sockaddr_in addr;
+  int rc = uv_ip4_addr(ip, port, &addr);
+  if (rc)
+    return rc;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return uv_translate_sys_error(errno);
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+  if (bind(fd, (const struct sockaddr *)&addr, sizeof addr) != 0) {
+    rc = uv_translate_sys_error(errno);
+    close(fd);
+    return rc;
+  }
+  Listener *l = calloc(1, sizeof(Listener));
+  if (!l) {
+    close(fd);
+    return UV_ENOMEM;
+  }
+  uv_tcp_init(m->loop, &l->tcp);
+  uv_tcp_open(&l->tcp, fd);
+  l->next = m->listeners;
+  m->listeners = l;
+  *out = l;
+  return 0;
+}
+
+static void on_bind(Child *c, const char *args) {
+  Master *m = c->m;
+  char ip[64];
+  int port;
+  if (sscanf(args, "%63s %d", ip, &port) != 2) {
+    reply(c, "err bad request\n", NULL);
+    return;
+  }
+  Listener *l = m->listeners;
+  while (l && strcmp(l->addr, args) != 0)
+    l = l->next;
+  if (!l) {
+    int rc = listener_bind(m, ip, port, &l);
+    if (rc) {
+      char msg[128];
+      snprintf(msg, sizeof msg, "err %s\n", uv_strerror(rc));
+      reply(c, msg, NULL);
+      return;
+    }
+    snprintf(l->addr, sizeof l->addr, "%s", args);
+  }
+  reply(c, "ok\n", &l->tcp);
+}
+
+static void on_stats(Child *c, const char *args) {
+  SfStats *st = &c->stats;
+  unsigned long long cpu, dropped, records, log_dropped, rejected, reclaimed;
+  if (sscanf(args, "%zu %zu %llu %u %llu %llu %llu %u %llu %llu", &st->bytes,
+             &st->peak_bytes, &cpu, &st->handles, &dropped, &records,
+             &log_dropped, &st->loop_lag_ms, &rejected, &reclaimed) != 10)
+    return;
+  st->cpu_ns = cpu;
+  st->out_dropped = dropped;
+  st->log_records = records;
+  st->log_dropped = log_dropped;
+  st->conn_rejected = rejected;
+  st->stack_reclaimed = reclaimed;
+}
+
+static void on_alloc(uv_handle_t *handle, size_t suggested_size,
+                     uv_buf_t *buf) {
+  (void)suggested_size;
+  Child *c = (Child *)handle->data;
+  buf->base = c->in + c->len;
+  buf->len = sizeof c->in - 1 - c->len;
+}
+
+static void on_read(uv_stream_t *s, ssize_t nread, const uv_buf_t *buf) {
+  (void)buf;
+  Child *c = (Child *)s->data;
+  if (nread < 0) {
+    // EOF, or a line too long to be a request: wait for the exit.
+    uv_read_stop(s);
+    return;
+  }
+  c->len += (size_t)nread;
+  c->in[c->len] = '\0';
+  char *line = c->in, *nl;
+  while ((nl = strchr(line, '\n'))) {
+    *nl = '\0';
+    if (strncmp(line, "bind ", 5) == 0)
+      on_bind(c, line + 5);
+    else if (strncmp(line, "stats ", 6) == 0)
+      on_stats(c, line + 6);
+    line = nl + 1;
+  }
+  c->len = strlen(line);
+  memmove(c->in, line, c->len);
+}
+
+static void on_restart(uv_timer_t *t) { spawn((Child *)t->data); }
+
+// The loop ends once no worker is running or due to restart; the signal
+// handlers are unref'd and the listeners never become active.
+static void close_all(Master *m) {
+  for (int i = 0; i < 4; i++)
+    uv_close((uv_handle_t *)&m->sig[i], NULL);
+  for (int i = 0; i < m->n; i++)
+    uv_close((uv_handle_t *)&m->child[i].restart, NULL);
+  for (Listener *l = m->listeners; l; l = l->next)
+    uv_close((uv_handle_t *)&l->tcp, NULL);
+}
+
+// Start a failed worker again, unless it keeps failing straight away.
+static void restart(Child *c, uint64_t ran) {
+  c->quick = ran < RESTART_DELAY_MS ? c->quick + 1 : 0;
+  if (c->quick >= RESTART_LIMIT) {
+    fprintf(stderr, "worker %d: giving up after %u failed starts\n", c->slot,
+            c->quick);
+    return;
+  }
+  c->restarts++;
+  uv_timer_start(&c->restart, on_restart,
+                 ran < RESTART_DELAY_MS ? RESTART_DELAY_MS : 0, 0);
+}
+
+static void on_child_exit(uv_process_t *proc, int64_t status, int signum) {
+  Child *c = (Child *)proc->data;
+  Master *m = c->m;
+  c->alive = false;
+  m->alive--;
+  uv_close((uv_handle_t *)&c->proc, NULL);
+  uv_close((uv_handle_t *)&c->ipc, NULL);
+  memset(&c->stats, 0, sizeof c->stats);
+  // A clean exit (bye, or the end of a drain) is not restarted, and neither
+  // is one the master asked for by passing on SIGTERM.
+  c->failed = signum ? !(m->stopping && signum == SIGTERM) : status != 0;
+  if (!c->failed)
+    return;
+  if (signum)
+    fprintf(stderr, "worker %d (pid %d) killed by signal %d\n", c->slot,
+            proc->pid, signum);
+  else
+    fprintf(stderr, "worker %d (pid %d) exited with status %lld\n", c->slot,
+            proc->pid, (long long)status);
+  if (!m->stopping)
+    restart(c, uv_now(m->loop) - c->started);
+}
+
+static void spawn(Child *c) {
+  Master *m = c->m;
+  uv_pipe_init(m->loop, &c->ipc, 1);
+  c->ipc.data = c;
+  c->len = 0;
+  uv_stdio_container_t stdio[WORKER_FD + 1];
+  for (int fd = 0; fd < WORKER_FD; fd++) {
+    stdio[fd].flags = UV_INHERIT_FD;
+    stdio[fd].data.fd = fd;
+  }
+  stdio[WORKER_FD].flags =
+      (uv_stdio_flags)(UV_CREATE_PIPE | UV_READABLE_PIPE | UV_WRITABLE_PIPE);
+  stdio[WORKER_FD].data.stream = (uv_stream_t *)&c->ipc;
+  uv_process_options_t opt = {0};
+  opt.file = m->exe;
+  opt.args = m->argv;
+  opt.exit_cb = on_child_exit;
+  opt.stdio = stdio;
+  opt.stdio_count = WORKER_FD + 1;
+  c->proc.data = c;
+  int rc = uv_spawn(m->loop, &c->proc, &opt);
+  c->started = uv_now(m->loop);
+  if (rc) {
+    fprintf(stderr, "worker %d: %s\n", c->slot, uv_strerror(rc));
+    uv_close((uv_handle_t *)&c->proc, NULL);
+    uv_close((uv_handle_t *)&c->ipc, NULL);
+    c->failed = true;
+    if (!m->stopping)
+      restart(c, 0);
+    return;
+  }
+  c->alive = true;
+  m->alive++;
+  uv_read_start((uv_stream_t *)&c->ipc, on_alloc, on_read);
+}
+
+// The same fields as the `stats` word, per worker and summed.
+static void print_stats(const char *who, const SfStats *st) {
+  fprintf(stderr,
+          "%s bytes %zu peak %zu cpu-us %llu handles %u out-dropped %llu "
+          "log-records %llu log-dropped %llu lag-ms %u conn-rejected %llu "
+          "stack-reclaimed %llu\n",
+          who, st->bytes, st->peak_bytes,
+          (unsigned long long)(st->cpu_ns / 1000), st->handles,
+          (unsigned long long)st->out_dropped,
+          (unsigned long long)st->log_records,
+          (unsigned long long)st->log_dropped, st->loop_lag_ms,
+          (unsigned long long)st->conn_rejected,
+          (unsigned long long)st->stack_reclaimed);
+}
+
+static void report(Master *m) {
+  SfStats total = {0};
+  unsigned restarts = 0;
+  char who[96];
+  for (int i = 0; i < m->n; i++) {
+    Child *c = &m->child[i];
+    const SfStats *st = &c->stats;
+    restarts += c->restarts;
+    if (!c->alive) {
+      fprintf(stderr, "worker %d down restarts %u\n", i, c->restarts);
+      continue;
+    }
+    snprintf(who, sizeof who, "worker %d pid %d up %llus restarts %u", i,
+             c->proc.pid,
+             (unsigned long long)((uv_now(m->loop) - c->started) / 1000),
+             c->restarts);
+    print_stats(who, st);
+    total.bytes += st->bytes;
+    total.peak_bytes += st->peak_bytes;
+    total.cpu_ns += st->cpu_ns;
+    total.handles += st->handles;
+    total.out_dropped += st->out_dropped;
+    total.log_records += st->log_records;
+    total.log_dropped += st->log_dropped;
+    if (st->loop_lag_ms > total.loop_lag_ms)
+      total.loop_lag_ms = st->loop_lag_ms;
+    total.conn_rejected += st->conn_rejected;
+    total.stack_reclaimed += st->stack_reclaimed;
+  }
+  snprintf(who, sizeof who, "total workers %d/%d restarts %u", m->alive, m->n,
+           restarts);
+  print_stats(who, &total);
+}
+
+static void on_signal(uv_signal_t *s, int signum) {
+  Master *m = (Master *)s->data;
+  if (signum == SIGUSR1) {
+    report(m);
+    return;
+  }
+  if (signum != SIGHUP && !m->stopping) {
+    m->stopping = true;
+    for (int i = 0; i < m->n; i++)
+      uv_timer_stop(&m->child[i].restart);
+  }
+  // A second SIGTERM reaches scripts that drain as "exit now".
+  for (int i = 0; i < m->n; i++)
+    if (m->child[i].alive)
+      uv_process_kill(&m->child[i].proc, signum == SIGINT ? SIGTERM : signum);
+}
+
+int prefork_run(int workers, char **argv) {
+  Master m = {0};
+  m.loop = uv_default_loop();
+  m.argv = argv;
+  m.n = workers;
+  size_t size = sizeof m.exe;
+  int rc = uv_exepath(m.exe, &size);
+  if (rc) {
+    fprintf(stderr, "workers: %s\n", uv_strerror(rc));
+    return 1;
+  }
+  char fd[16];
+  snprintf(fd, sizeof fd, "%d", WORKER_FD);
+  setenv("SOLARFORTH_WORKER_FD", fd, 1);
+
+  // libuv writes to the workers' pipes without MSG_NOSIGNAL: a worker that
+  // dies before its reply arrives must not take the master with it. uv_spawn
+  // gives the workers back the default action.
+  signal(SIGPIPE, SIG_IGN);
+  const int signums[4] = {SIGTERM, SIGINT, SIGHUP, SIGUSR1};
+  for (int i = 0; i < 4; i++) {
+    uv_signal_init(m.loop, &m.sig[i]);
+    m.sig[i].data = &m;
+    uv_signal_start(&m.sig[i], on_signal, signums[i]);
+    uv_unref((uv_handle_t *)&m.sig[i]);
+  }
+  m.child = calloc((size_t)workers, sizeof(Child));
+  if (!m.child) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  for (int i = 0; i < workers; i++) {
+    Child *c = &m.child[i];
+    c->m = &m;
+    c->slot = i;
+    uv_timer_init(m.loop, &c->restart);
+    c->restart.data = c;
+    spawn(c);
+  }
+  uv_run(m.loop, UV_RUN_DEFAULT);
+  close_all(&m);
+  uv_run(m.loop, UV_RUN_DEFAULT);
+
+  while (m.listeners) {
+    Listener *next = m.listeners->next;
+    free(m.listeners);
+    m.listeners = next;
+  }
+  int status = 0;
+  for (int i = 0; i < workers; i++)
+    if (m.child[i].failed)
+      status = 1;
+  free(m.child);
+  return status;
+}
@@ -0,0 +1,12 @@
+// Prefork master for `solarforth --workers N` (see prefork.c).
+#ifndef PREFORK_H
+#define PREFORK_H
+
+// Run `workers` copies of this binary with `argv` as their command line,
+// serving their listening sockets and restarting them when they crash.
+// Returns the process exit status once they have all exited: 1 if the last
+// run of any worker failed (including one given up after failing on every
+// restart), else 0.
+int prefork_run(int workers, char **argv);
+
+#endif
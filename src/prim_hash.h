@@ -0,0 +1,25 @@
+/*
+Seeded string hash shared by tools/genprims.c and the runtime lookup in
+solarforth.c; both must agree for the generated tables to be valid.
+*/
+
+#ifndef SOLARFORTH_PRIM_HASH_H
+#define SOLARFORTH_PRIM_HASH_H
+
+#include <stdint.h>
+
+// FNV-1a over the bytes, started from the seed and finished with a mix so
+// that the low bits (used as the index) depend on every byte.
+static inline uint32_t prim_hash(const char *s, uint32_t seed) {
+  uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 16777619u;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  return h;
+}
+
+#endif
@@ -10,21 +10,54 @@ Guiding ideas
 - Minimal surface: only a handful of core words plus uv:* words.
 - Late binding: quotations [ ... ] store tokens; names resolve when run.
 
+This file is libsolarforth; src/main.c is the command-line driver and
+src/solarforth.h the embedding API. Errors unwind with longjmp to the
+innermost trap, set by sf_eval and around every callback that runs a quote.
+
 Build
-  cc -O2 -Wall -Wextra -std=c11 -o solarforth src/solarforth.c -luv
+  make            (libsolarforth.a and the solarforth binary)
 */
 
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // syscall(2), for io_uring
 #include <ctype.h>
+#include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <uv.h>
 
+// The io_uring backend needs the Linux 6.0 uapi header (multishot recv).
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_RECV_MULTISHOT
+#include <sys/syscall.h>
+#define SF_URING 1
+#endif
+#endif
+#endif
+
+#include "prim_hash.h"
+#include "prims.gen.h"
+#include "solarforth.h"
+
 // Forward declarations for core runtime types.
 typedef struct Word Word;   // A named entry in the dictionary
 typedef struct Quote Quote; // A sequence of tokens to run later
@@ -40,9 +73,22 @@ typedef enum {
   HND_NONE = 0,
   HND_TIMER,
   HND_TCP,
+  HND_FS_EVENT,
+  HND_REPL, // remote REPL listener or session
+  HND_SIGNAL,
+  HND_POLL, // a descriptor owned by someone else
+  HND_RING, // shared-memory ring
 } HandleType;
 
 typedef struct Handle Handle;
+typedef struct Sim Sim;
+typedef struct SimHandle SimHandle;
+typedef struct Repl Repl;
+typedef struct StdioWriter StdioWriter;
+typedef struct Admission Admission;
+typedef struct Ring Ring;
+typedef struct Uring Uring;
+typedef struct UringConn UringConn;
 
 typedef struct {
   ValType type;
@@ -59,41 +105,122 @@ typedef struct {
   Value *data; // contiguous buffer
   int top;     // index of next free slot
   int cap;     // allocated capacity
+  int floor;   // values below belong to an outer callback frame
 } Stack;
 
 typedef struct Dict Dict;
 
 // The whole VM state: stacks, dictionary, and the libuv loop.
-typedef struct Context {
-  Stack ds;        // data stack
-  Stack rs;        // return stack (reserved)
-  Dict *dict;      // dictionary of words
-  uv_loop_t *loop; // libuv event loop
-  bool running;    // flag to keep the REPL alive
-} Context;
-
-// A quotation is a small growable array of string tokens.
+typedef struct SfContext Context;
+struct SfContext {
+  Stack ds;         // data stack
+  Stack rs;         // return stack (reserved)
+  Dict *dict;       // dictionary of words
+  uv_loop_t *loop;  // libuv event loop
+  bool running;     // flag to keep the REPL alive
+  Handle *handles;  // live handles, closed by sf_context_free
+  jmp_buf *trap;    // innermost error boundary
+  int err;          // status of the last error
+  char errmsg[256]; // message of the last error
+  int run_depth;    // nesting of uv:run in this context
+  int run_err;      // callback error that stopped uv:run, if any
+  SfErrorFn on_error;
+  void *on_error_data;
+  SfLimits limits;     // 0 = unlimited
+  size_t mem;          // accounted bytes, excluding the stacks
+  size_t mem_peak;     // high-water mark of sf_stats' bytes
+  uint64_t cpu_ns;     // loop-thread time spent running this context
+  uint64_t cpu_start;  // when the current metered slice began
+  int meter_depth;     // nesting of metered entries (eval, callbacks)
+  unsigned tick;       // token counter for periodic limit checks
+  uint32_t nhandles;   // live handles
+  Sim *sim;            // virtual clock and loopback network, or NULL
+  Quote **retired;     // replaced definition bodies awaiting free
+  int nretired;
+  int retired_cap;
+  const Quote **active; // colon bodies being run, innermost last
+  int nactive;
+  int active_cap;
+  jmp_buf *run_trap;   // the error boundary uv:run was entered under
+  int run_active;      // bodies running below uv:run: nactive then
+  SfOutputFn out;      // where print and cr go; NULL = stdout
+  void *out_data;
+  StdioWriter *stdout_w; // shared writers for fds 1 and 2, once used
+  StdioWriter *stderr_w;
+  struct Log *log;       // log:* ring buffer, once used
+  bool draining;         // `drain` ran: waiting for connections to end
+  uv_timer_t *lag_timer; // loop lag probe, for uv:listen-shed
+  uint64_t lag_due;      // hrtime the probe should fire at
+  uint32_t lag_ms;       // measured loop lag
+  uint64_t conn_rejected; // connections refused by admission control
+  uint64_t reclaimed;     // values callbacks left on the stack
+  bool cb_warn;           // callback:warn: report each leftover
+  struct Worker *worker;  // link to a --workers master, or NULL
+  uv_check_t *batch_check; // delivers batched reads after each poll
+  Handle *batch_pending;   // handles with batched data or EOF waiting
+  struct Arena *arena;     // where str_alloc carves from, if not the heap
+  Uring *uring;            // io_uring backend (sf_use_io_uring), or NULL
+  uv_timer_t *watch_retry; // re-arms watches whose file went missing
+};
+
+// A quotation is a small growable array of string tokens. Quotes are
+// immutable once built and shared by reference count between the stack,
+// handles and definitions. A closure (curry, compose) adds values captured
+// when it was made, pushed from this array each time it runs, and up to two
+// quotes that run after its own tokens.
 struct Quote {
   char **tokens;
   int count;
+  int refs;
+  Value *captured; // strings here are plain heap copies, not StrHdr
+  int ncaptured;
+  Quote *parts[2];
 };
 
 typedef void (*PrimFn)(Context *);
 
 // A dictionary entry: either a C primitive or a colon definition.
 struct Word {
-  char *name;     // word name
-  bool immediate; // reserved (not used in this tiny system)
-  bool is_prim;   // true for C primitives
-  PrimFn prim;    // set if is_prim
-  Quote *code;    // set if colon definition
-  Word *next;     // singly-linked list
+  const char *name; // word name
+  bool immediate;   // reserved (not used in this tiny system)
+  bool is_prim;     // true for C primitives
+  PrimFn prim;      // set if is_prim
+  Quote *code;      // set if colon definition
+  Word *next;       // singly-linked list
 };
 
-// The dictionary is a simple singly-linked list for clarity.
+// The dictionary is a simple singly-linked list for clarity. It only holds
+// what a context adds at runtime: colon definitions and host primitives.
+// An overlay context's dictionary falls back to its base's, which it keeps
+// alive with a reference.
 struct Dict {
   Word *head;
+  Dict *parent; // base context's dictionary, or NULL
+  int refs;
+};
+
+// The built-in words live in one static table shared by every context and
+// found through the perfect hash that tools/genprims.c generates from the
+// same list, so starting a context allocates nothing for them.
+#define PRIM(word, fn) static void fn(Context *ctx);
+#include "prims.def"
+#undef PRIM
+
+static const Word prim_table[] = {
+#define PRIM(word, fn) {.name = word, .is_prim = true, .prim = fn},
+#include "prims.def"
+#undef PRIM
 };
+_Static_assert(sizeof(prim_table) / sizeof(prim_table[0]) == PRIM_COUNT,
+               "prims.gen.h is out of date with prims.def");
+
+static const Word *prim_lookup(const char *name) {
+  uint32_t b = prim_hash(name, 0) & PRIM_BUCKET_MASK;
+  int i = prim_slots[prim_hash(name, prim_disp[b]) & PRIM_SLOT_MASK];
+  if (i >= 0 && strcmp(prim_table[i].name, name) == 0)
+    return &prim_table[i];
+  return NULL;
+}
 
 // ---------------- Memory / utility helpers ----------------
 // These wrappers keep the call sites clean and make failures obvious.
@@ -121,17 +248,253 @@ static char *xstrdup(const char *s) {
   return r;
 }
 
+// ---------------- Errors ----------------
+// Record the error and unwind to the innermost trap. Traps are installed by
+// sf_eval and by run_callback, so this is only reached without one when a
+// host calls sf_fail outside a primitive.
+static _Noreturn void rethrow(Context *ctx) {
+  if (!ctx->trap) {
+    fprintf(stderr, "solarforth: %s (no error trap)\n", ctx->errmsg);
+    abort();
+  }
+  longjmp(*ctx->trap, 1);
+}
+static _Noreturn void vfail(Context *ctx, int status, const char *fmt,
+                            va_list ap) {
+  ctx->err = status;
+  vsnprintf(ctx->errmsg, sizeof(ctx->errmsg), fmt, ap);
+  rethrow(ctx);
+}
+static _Noreturn void fail(Context *ctx, int status, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vfail(ctx, status, fmt, ap);
+}
+
+// ---------------- Accounting ----------------
+// Each context counts the bytes it holds (strings, definitions, handles and
+// I/O buffers; the stacks are added in mem_total) and the loop-thread time
+// spent running its code. Charging never fails: limits are enforced at
+// safe points in exec_tokens, where raising an error is always possible.
+static void mem_charge(Context *ctx, size_t n) {
+  if (!ctx)
+    return;
+  ctx->mem += n;
+}
+static void mem_release(Context *ctx, size_t n) {
+  if (!ctx)
+    return;
+  ctx->mem -= n < ctx->mem ? n : ctx->mem;
+}
+static size_t mem_total(Context *ctx) {
+  size_t total =
+      ctx->mem + (size_t)(ctx->ds.cap + ctx->rs.cap) * sizeof(Value);
+  if (total > ctx->mem_peak)
+    ctx->mem_peak = total;
+  return total;
+}
+
+// Time is metered around every entry into the interpreter. Re-entries (a
+// callback of this context firing under its own uv:run) are folded into
+// the outermost slice; uv:run itself pauses the meter.
+static void meter_enter(Context *ctx) {
+  if (ctx->meter_depth++ == 0)
+    ctx->cpu_start = uv_hrtime();
+}
+static void meter_leave(Context *ctx) {
+  if (--ctx->meter_depth == 0)
+    ctx->cpu_ns += uv_hrtime() - ctx->cpu_start;
+}
+static uint64_t meter_now(Context *ctx) {
+  if (ctx->meter_depth == 0)
+    return ctx->cpu_ns;
+  return ctx->cpu_ns + (uv_hrtime() - ctx->cpu_start);
+}
+
+// Called every token while limits are set.
+static void check_limits(Context *ctx) {
+  if (ctx->limits.max_bytes && mem_total(ctx) > ctx->limits.max_bytes)
+    fail(ctx, SF_ERR_LIMIT, "memory limit exceeded (%zu bytes)",
+         ctx->limits.max_bytes);
+  if (ctx->limits.max_cpu_ns && (++ctx->tick & 255) == 0 &&
+      meter_now(ctx) > ctx->limits.max_cpu_ns)
+    fail(ctx, SF_ERR_LIMIT, "cpu limit exceeded (%llu ns)",
+         (unsigned long long)ctx->limits.max_cpu_ns);
+}
+
+// ---------------- Strings ----------------
+// String values carry their allocation size in a small header so that
+// whoever frees them can credit the owning context. They are only ever
+// released with str_free; hosts get plain malloc'd copies.
+typedef struct Arena Arena;
+typedef struct {
+  size_t size;
+  Arena *arena; // the arena it was carved from, or NULL for the heap
+} StrHdr;
+
+// A connection with uv:arena takes the small strings it reads, and those
+// made while its callbacks run, from an arena of ARENA_CHUNK blocks instead
+// of the heap. Freeing one only counts it; once none is live the arena
+// rewinds to its first block, and closing the handle frees it all at once,
+// so weeks of per-event strings leave no fragments behind. Strings that
+// outlive the event (handle:data!, a write to another connection) are
+// copied to the heap, and an arena closed with strings still live stays
+// until the last of them is freed.
+#define ARENA_CHUNK 16384
+#define ARENA_MAX_ALLOC 2048 // larger strings go to the heap
+
+typedef struct ArenaChunk {
+  struct ArenaChunk *next;
+  size_t size, used;
+  char data[];
+} ArenaChunk;
+
+struct Arena {
+  ArenaChunk *chunks; // newest first
+  size_t bytes;       // allocated, charged to ctx
+  size_t live;        // strings not yet freed
+  Context *ctx;       // charged for the blocks; NULL once detached
+  bool closed;        // the handle is gone
+};
+
+static void arena_trim(Arena *a, ArenaChunk *keep) {
+  ArenaChunk *c = a->chunks;
+  while (c) {
+    ArenaChunk *next = c->next;
+    if (c != keep) {
+      a->bytes -= sizeof(ArenaChunk) + c->size;
+      mem_release(a->ctx, sizeof(ArenaChunk) + c->size);
+      free(c);
+    }
+    c = next;
+  }
+  a->chunks = keep;
+  if (keep) {
+    keep->next = NULL;
+    keep->used = 0;
+  }
+}
+
+static StrHdr *arena_alloc(Arena *a, size_t size) {
+  size = (size + 7) & ~(size_t)7;
+  ArenaChunk *c = a->chunks;
+  if (!c || c->used + size > c->size) {
+    c = (ArenaChunk *)xmalloc(sizeof(ArenaChunk) + ARENA_CHUNK);
+    c->size = ARENA_CHUNK;
+    c->used = 0;
+    c->next = a->chunks;
+    a->chunks = c;
+    a->bytes += sizeof(ArenaChunk) + ARENA_CHUNK;
+    mem_charge(a->ctx, sizeof(ArenaChunk) + ARENA_CHUNK);
+  }
+  StrHdr *hdr = (StrHdr *)(c->data + c->used);
+  c->used += size;
+  a->live++;
+  hdr->arena = a;
+  return hdr;
+}
+
+static void arena_put(Arena *a) {
+  if (--a->live > 0)
+    return;
+  if (a->closed) { // this was the last string
+    arena_trim(a, NULL);
+    free(a);
+    return;
+  }
+  ArenaChunk *first = a->chunks;
+  while (first && first->next)
+    first = first->next;
+  arena_trim(a, first);
+}
+
+static void arena_close(Arena *a) {
+  if (!a)
+    return;
+  mem_release(a->ctx, a->bytes);
+  a->ctx = NULL;
+  a->closed = true;
+  if (a->live == 0) {
+    arena_trim(a, NULL);
+    free(a);
+  }
+}
+
+static char *str_alloc(Context *ctx, size_t len) {
+  size_t size = sizeof(StrHdr) + len + 1;
+  StrHdr *hdr;
+  if (ctx && ctx->arena && size <= ARENA_MAX_ALLOC) {
+    hdr = arena_alloc(ctx->arena, size);
+  } else {
+    hdr = (StrHdr *)xmalloc(size);
+    hdr->arena = NULL;
+    mem_charge(ctx, size);
+  }
+  hdr->size = size;
+  char *s = (char *)(hdr + 1);
+  s[len] = '\0';
+  return s;
+}
+static char *str_dup(Context *ctx, const char *src) {
+  size_t len = strlen(src);
+  char *s = str_alloc(ctx, len);
+  memcpy(s, src, len);
+  return s;
+}
+static void str_free(Context *ctx, char *s) {
+  if (!s)
+    return;
+  StrHdr *hdr = (StrHdr *)s - 1;
+  if (hdr->arena) {
+    arena_put(hdr->arena);
+    return;
+  }
+  mem_release(ctx, hdr->size);
+  free(hdr);
+}
+
+// s itself if it may outlive the event that made it, else a heap copy of
+// it (keep is an arena the string is allowed to stay in).
+static char *str_escape(Context *ctx, char *s, const Arena *keep) {
+  StrHdr *hdr = (StrHdr *)s - 1;
+  if (!hdr->arena || hdr->arena == keep)
+    return s;
+  Arena *arena = ctx->arena;
+  ctx->arena = NULL;
+  char *copy = str_dup(ctx, s);
+  ctx->arena = arena;
+  str_free(ctx, s);
+  return copy;
+}
+
+static Quote *quote_retain(Quote *q);
+static void quote_release(Quote *q);
+// A second stack value equal to v: strings are copied, quotes shared.
+static Value value_copy(Context *ctx, Value v) {
+  if (v.type == VAL_STRING)
+    v.as.s = str_dup(ctx, v.as.s);
+  else if (v.type == VAL_QUOTE)
+    quote_retain(v.as.q);
+  return v;
+}
+// Release what a value owns once it leaves the stack.
+static void value_free(Context *ctx, Value v) {
+  if (v.type == VAL_STRING)
+    str_free(ctx, v.as.s);
+  else if (v.type == VAL_QUOTE)
+    quote_release(v.as.q);
+}
+
 // A tiny, growable stack used for the data stack and (reserved) return stack.
 static void stack_init(Stack *s) {
   s->cap = 64;
   s->top = 0;
+  s->floor = 0;
   s->data = (Value *)xcalloc(s->cap, sizeof(Value));
 }
-static void stack_free(Stack *s) {
-  for (int i = 0; i < s->top; i++) {
-    if (s->data[i].type == VAL_STRING && s->data[i].as.s)
-      free(s->data[i].as.s);
-  }
+static void stack_free(Context *ctx, Stack *s) {
+  for (int i = 0; i < s->top; i++)
+    value_free(ctx, s->data[i]);
   free(s->data);
 }
 static void push(Stack *s, Value v) {
@@ -143,18 +506,14 @@ static void push(Stack *s, Value v) {
   }
   s->data[s->top++] = v;
 }
-static Value pop(Stack *s) {
-  if (s->top <= 0) {
-    fprintf(stderr, "stack underflow\n");
-    exit(1);
-  }
+static Value pop(Context *ctx, Stack *s) {
+  if (s->top <= s->floor)
+    fail(ctx, SF_ERR_UNDERFLOW, "stack underflow");
   return s->data[--s->top];
 }
-static Value peek(Stack *s) {
-  if (s->top <= 0) {
-    fprintf(stderr, "stack underflow\n");
-    exit(1);
-  }
+static Value peek(Context *ctx, Stack *s) {
+  if (s->top <= s->floor)
+    fail(ctx, SF_ERR_UNDERFLOW, "stack underflow");
   return s->data[s->top - 1];
 }
 
@@ -171,7 +530,9 @@ static Value VStrTake(char *s) {
   v.as.s = s;
   return v;
 }
-static Value VStr(const char *s) { return VStrTake(xstrdup(s)); }
+static Value VStr(Context *ctx, const char *s) {
+  return VStrTake(str_dup(ctx, s));
+}
 static Value VQuote(Quote *q) {
   Value v;
   v.type = VAL_QUOTE;
@@ -180,15 +541,22 @@ static Value VQuote(Quote *q) {
 }
 
 // A tiny linked-list dictionary that uses linear lookup.
-static Dict *dict_new(void) {
+static Dict *dict_new(Dict *parent) {
   Dict *d = (Dict *)xcalloc(1, sizeof(Dict));
+  d->refs = 1;
+  d->parent = parent;
+  if (parent)
+    parent->refs++;
   return d;
 }
-static Word *dict_lookup(Dict *d, const char *name) {
-  for (Word *w = d->head; w; w = w->next)
-    if (strcmp(w->name, name) == 0)
-      return w;
-  return NULL;
+// Runtime definitions shadow the base's, which shadow the built-ins;
+// newest first at each level.
+static const Word *dict_lookup(Dict *d, const char *name) {
+  for (; d; d = d->parent)
+    for (Word *w = d->head; w; w = w->next)
+      if (strcmp(w->name, name) == 0)
+        return w;
+  return prim_lookup(name);
 }
 static Word *dict_add_prim(Dict *d, const char *name, PrimFn fn,
                            bool immediate) {
@@ -201,6 +569,22 @@ static Word *dict_add_prim(Dict *d, const char *name, PrimFn fn,
   d->head = w;
   return w;
 }
+static void word_code_free(Quote *code);
+static void dict_release(Dict *d) {
+  if (!d || --d->refs > 0)
+    return;
+  Word *w = d->head;
+  while (w) {
+    Word *next = w->next;
+    if (!w->is_prim)
+      word_code_free(w->code);
+    free((char *)w->name);
+    free(w);
+    w = next;
+  }
+  dict_release(d->parent);
+  free(d);
+}
 static Word *dict_add_colon(Dict *d, const char *name, Quote *code) {
   Word *w = (Word *)xcalloc(1, sizeof(Word));
   w->name = xstrdup(name);
@@ -353,10 +737,11 @@ static void scan_tokens(const char *src, TokStream *ts) {
   }
 }
 
-// A quotation is a growable list of tokens. We create, append to, and free
-// with 3 helpers.
+// A quotation is a growable list of tokens. We create, append to, share
+// and release with 4 helpers.
 static Quote *quote_new(void) {
   Quote *q = (Quote *)xcalloc(1, sizeof(Quote));
+  q->refs = 1;
   return q;
 }
 static void quote_add_token(Quote *q, const char *tok) {
@@ -365,14 +750,48 @@ static void quote_add_token(Quote *q, const char *tok) {
     oom();
   q->tokens[q->count++] = xstrdup(tok);
 }
-static void quote_free(Quote *q) {
-  if (!q)
+static Quote *quote_retain(Quote *q) {
+  if (q)
+    q->refs++;
+  return q;
+}
+// Approximate heap footprint, for accounting definitions.
+static size_t quote_bytes(const Quote *q) {
+  size_t n = sizeof(Quote) + (size_t)q->count * sizeof(char *);
+  for (int i = 0; i < q->count; i++)
+    n += strlen(q->tokens[i]) + 1;
+  return n;
+}
+static void quote_release(Quote *q) {
+  if (!q || --q->refs > 0)
     return;
   for (int i = 0; i < q->count; i++)
     free(q->tokens[i]);
   free(q->tokens);
+  for (int i = 0; i < q->ncaptured; i++) {
+    if (q->captured[i].type == VAL_STRING)
+      free(q->captured[i].as.s);
+    else if (q->captured[i].type == VAL_QUOTE)
+      quote_release(q->captured[i].as.q);
+  }
+  free(q->captured);
+  quote_release(q->parts[0]);
+  quote_release(q->parts[1]);
   free(q);
 }
+// A colon definition owns the quotes it captured as "#Q:<ptr>" literals.
+static void word_code_free(Quote *code) {
+  if (!code)
+    return;
+  for (int i = 0; i < code->count; i++) {
+    if (strncmp(code->tokens[i], "#Q:", 3) == 0) {
+      void *ptr = NULL;
+      sscanf(code->tokens[i] + 3, "%p", &ptr);
+      quote_release((Quote *)ptr);
+    }
+  }
+  quote_release(code);
+}
 
 // A Handle bundles a libuv handle with the VM context and any associated
 // quotations to run on events.
@@ -381,108 +800,658 @@ struct Handle {
   union {
     uv_handle_t base;
     uv_timer_t timer;
+    uv_stream_t stream;
     uv_tcp_t tcp;
+    uv_pipe_t pipe;
+    uv_tty_t tty;
+    uv_fs_event_t fs_event;
+    uv_signal_t signal;
+    uv_poll_t poll;
   } u;
   Quote *cb1;   // primary callback quotation
   Quote *cb2;   // optional secondary callback (unused here)
-  Context *ctx; // to reach the VM from libuv callbacks
+  char *path;   // watched file (fs events)
+  char *cached; // file:cache contents
+  bool stale;   // ... and the file changed since they were read
+  Context *ctx; // to reach the VM from libuv callbacks; NULL once detached
+  SimHandle *sim; // simulation state, in simulated contexts only
+  Repl *repl;     // remote REPL session buffers
+  bool listening; // a TCP listener
+  bool eof;       // a stream whose peer has hung up
+  Admission *adm; // connection limits of a listener, shared with its clients
+  void (*native)(Handle *h, int signum); // built-in signal handler
+  Value data;     // handle:data! slot, released with the handle (0 if unset)
+  struct Batch *batch; // uv:read-batch state, once enabled
+  uint32_t rbuf;       // read buffer size; 0 until the first read
+  bool rbuf_fixed;     // set by uv:read-buffer, else adaptive
+  bool use_arena;      // uv:arena; a listener passes it to its clients
+  struct Arena *arena; // strings made in this handle's callbacks
+  Ring *ring;          // shm:ring or shm:open mapping
+  UringConn *io;       // on the io_uring backend, else libuv
+  uint8_t rbuf_small;  // consecutive reads that used little of it
+  Handle *prev; // the context's list of live handles
+  Handle *next;
 };
 
 static Handle *handle_new(Context *ctx, HandleType t) {
   Handle *h = (Handle *)xcalloc(1, sizeof(Handle));
   h->type = t;
   h->ctx = ctx;
+  mem_charge(ctx, sizeof(Handle));
+  ctx->nhandles++;
+  h->next = ctx->handles;
+  if (h->next)
+    h->next->prev = h;
+  ctx->handles = h;
   return h;
 }
+static void handle_unlink(Handle *h) {
+  if (!h->ctx)
+    return;
+  mem_release(h->ctx, sizeof(Handle));
+  h->ctx->nhandles--;
+  if (h->prev)
+    h->prev->next = h->next;
+  else
+    h->ctx->handles = h->next;
+  if (h->next)
+    h->next->prev = h->prev;
+  h->prev = h->next = NULL;
+}
+static void sim_handle_free(SimHandle *sh);
+static void repl_free(Context *ctx, Repl *r);
+static void drain_check(Context *ctx);
+static void admission_leave(Handle *h);
+static void batch_free(Context *ctx, Handle *h);
+static void ring_free(Ring *r);
+static void ring_unlink(Ring *r);
+static void uring_detach(Context *ctx, Handle *h);
+
 static void handle_free(Handle *h) {
   if (!h)
     return;
-  quote_free(h->cb1);
-  quote_free(h->cb2);
+  Context *ctx = h->ctx;
+  if (h->adm)
+    admission_leave(h);
+  handle_unlink(h);
+  sim_handle_free(h->sim);
+  repl_free(h->ctx, h->repl);
+  free(h->path);
+  if (h->cached)
+    mem_release(ctx, strlen(h->cached) + 1);
+  free(h->cached);
+  quote_release(h->cb1);
+  quote_release(h->cb2);
+  value_free(ctx, h->data);
+  batch_free(ctx, h);
+  arena_close(h->arena);
+  ring_free(h->ring);
   free(h);
+  drain_check(ctx);
 }
 
 static void exec_tokens(Context *ctx, char **tokens, int count);
 
-// Execute a quotation by interpreting its token list.
+// Execute a quotation by interpreting its token list, after pushing what a
+// closure captured and before the quotes it composes.
 static void exec_quote(Context *ctx, Quote *q) {
   if (!q)
     return;
+  for (int i = 0; i < q->ncaptured; i++)
+    push(&ctx->ds, value_copy(ctx, q->captured[i]));
   exec_tokens(ctx, q->tokens, q->count);
+  for (int i = 0; i < 2 && q->parts[i]; i++)
+    exec_quote(ctx, q->parts[i]);
+}
+
+// ---------------- Standard output ----------------
+// When stdout or stderr is a pipe or socket, a slow reader (a log collector,
+// say) must not stall the loop. Output then collects in a buffer that a
+// uv_poll handle drains with non-blocking writes once the fd is writable,
+// so the lines printed during a turn of the loop go out in one syscall. The
+// buffer is bounded: past STDIO_MAX_BUFFER further output is dropped and
+// counted (see `stats`). Terminals and files stay on stdio.
+//
+// The fd's open file description is shared with the parent and whatever
+// else writes to it, so it must stay blocking: a pipe is reopened through
+// /proc for a non-blocking description of our own, and a socket is written
+// with MSG_DONTWAIT. Where neither works, output stays on stdio.
+//
+// An fd is a process-wide resource and libuv allows one watcher per fd and
+// loop, so contexts on the same loop share one writer per fd. The last
+// context to let go of it writes what is left with the fd blocking again,
+// so nothing printed before sf_context_free is lost.
+
+#define STDIO_MAX_BUFFER ((size_t)4 << 20)
+#define STDIO_CHUNK 65536 // pending output worth a write right away
+
+struct StdioWriter {
+  uv_loop_t *loop;
+  int fd;
+  int refs;
+  bool async;       // pipe or socket, drained by `poll`
+  bool sock;        // written with send(2)
+  int wfd;          // what `poll` watches and output goes to
+  uv_poll_t *poll;  // heap: it finishes closing after the writer is gone
+  char *buf;        // output not yet written
+  size_t len, cap;
+  uint64_t dropped; // bytes discarded: buffer full or reader gone
+  StdioWriter *next;
+};
+
+static StdioWriter *stdio_writers;
+static uv_mutex_t stdio_lock;
+static uv_once_t stdio_once = UV_ONCE_INIT;
+
+static void stdio_lock_init(void) {
+  if (uv_mutex_init(&stdio_lock))
+    abort();
+}
+
+static FILE *stdio_file(int fd) { return fd == 1 ? stdout : stderr; }
+
+// Write what the fd takes (without blocking, unless `wait`). True once the
+// buffer is empty.
+static bool writer_drain(StdioWriter *w, bool wait) {
+  size_t off = 0;
+  while (off < w->len) {
+    ssize_t n =
+        w->sock ? send(w->wfd, w->buf + off, w->len - off,
+                       MSG_NOSIGNAL | (wait ? 0 : MSG_DONTWAIT))
+                : write(w->wfd, w->buf + off, w->len - off);
+    if (n > 0)
+      off += (size_t)n;
+    else if (n < 0 && errno == EINTR)
+      continue;
+    else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    else { // the reader is gone
+      w->dropped += w->len - off;
+      off = w->len;
+    }
+  }
+  memmove(w->buf, w->buf + off, w->len - off);
+  w->len -= off;
+  return w->len == 0;
+}
+
+static void on_stdio_writable(uv_poll_t *p, int status, int events) {
+  (void)events;
+  StdioWriter *w = (StdioWriter *)p->data;
+  if (status < 0) {
+    w->dropped += w->len;
+    w->len = 0;
+  }
+  if (status < 0 || writer_drain(w, false))
+    uv_poll_stop(p);
+}
+
+// Write on the loop's next turn, together with whatever else is printed
+// until then.
+static void writer_schedule(StdioWriter *w) {
+  if (!w->async)
+    fflush(stdio_file(w->fd));
+  else if (w->len && !uv_is_active((uv_handle_t *)w->poll))
+    uv_poll_start(w->poll, UV_WRITABLE, on_stdio_writable);
+}
+
+// Write now as far as the fd allows; the loop takes care of the rest.
+static void writer_flush(StdioWriter *w) {
+  if (!w->async)
+    fflush(stdio_file(w->fd));
+  else if (w->len && !uv_is_active((uv_handle_t *)w->poll) &&
+           !writer_drain(w, false))
+    uv_poll_start(w->poll, UV_WRITABLE, on_stdio_writable);
+}
+
+static void writer_put(StdioWriter *w, const char *s, size_t n) {
+  if (!w->async) {
+    fwrite(s, 1, n, stdio_file(w->fd));
+    return;
+  }
+  if (w->len + n > STDIO_MAX_BUFFER) {
+    w->dropped += n;
+    return;
+  }
+  if (w->len + n > w->cap) {
+    size_t cap = w->cap ? w->cap : 4096;
+    while (cap < w->len + n)
+      cap *= 2;
+    w->buf = (char *)realloc(w->buf, cap);
+    if (!w->buf)
+      oom();
+    w->cap = cap;
+  }
+  memcpy(w->buf + w->len, s, n);
+  w->len += n;
+  if (w->len >= STDIO_CHUNK)
+    writer_flush(w);
+}
+
+// The descriptor to write fd's output to without blocking anyone else: a
+// new description of the same pipe, or a socket itself; -1 for stdio.
+static int writer_fd(int fd, bool *sock) {
+  struct stat st;
+  uv_handle_type t = uv_guess_handle(fd);
+  if ((t != UV_NAMED_PIPE && t != UV_TCP) || fstat(fd, &st) != 0)
+    return -1;
+  if (S_ISSOCK(st.st_mode)) {
+    *sock = true;
+    return fd;
+  }
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  return S_ISFIFO(st.st_mode)
+             ? open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC)
+             : -1;
+}
+
+static StdioWriter *writer_acquire(uv_loop_t *loop, int fd) {
+  uv_once(&stdio_once, stdio_lock_init);
+  uv_mutex_lock(&stdio_lock);
+  StdioWriter *w = stdio_writers;
+  while (w && !(w->loop == loop && w->fd == fd))
+    w = w->next;
+  if (w) {
+    w->refs++;
+    uv_mutex_unlock(&stdio_lock);
+    return w;
+  }
+  w = (StdioWriter *)xcalloc(1, sizeof(StdioWriter));
+  w->loop = loop;
+  w->fd = fd;
+  w->refs = 1;
+  w->wfd = writer_fd(fd, &w->sock);
+  if (w->wfd >= 0) {
+    w->poll = (uv_poll_t *)xmalloc(sizeof(uv_poll_t));
+    int flags = fcntl(w->wfd, F_GETFL);
+    fflush(stdio_file(fd)); // whatever stdio holds goes first
+    if (flags >= 0 && uv_poll_init(loop, w->poll, w->wfd) == 0) {
+      w->poll->data = w;
+      w->async = true;
+      if (w->sock) // uv_poll_init made the shared description non-blocking
+        fcntl(w->wfd, F_SETFL, flags);
+    } else {
+      free(w->poll);
+      w->poll = NULL;
+      if (w->wfd != fd)
+        close(w->wfd);
+    }
+  }
+  w->next = stdio_writers;
+  stdio_writers = w;
+  uv_mutex_unlock(&stdio_lock);
+  return w;
+}
+
+static void free_on_close(uv_handle_t *h) { free(h); }
+
+static void writer_release(StdioWriter *w) {
+  if (!w)
+    return;
+  uv_mutex_lock(&stdio_lock);
+  if (--w->refs > 0) {
+    uv_mutex_unlock(&stdio_lock);
+    return;
+  }
+  StdioWriter **pp = &stdio_writers;
+  while (*pp != w)
+    pp = &(*pp)->next;
+  *pp = w->next;
+  uv_mutex_unlock(&stdio_lock);
+  if (w->async) {
+    if (!w->sock) // blocking again: the rest goes out now
+      fcntl(w->wfd, F_SETFL, fcntl(w->wfd, F_GETFL) & ~O_NONBLOCK);
+    writer_drain(w, true);
+    uv_close((uv_handle_t *)w->poll, free_on_close);
+    if (w->wfd != w->fd)
+      close(w->wfd);
+  } else {
+    fflush(stdio_file(w->fd));
+  }
+  free(w->buf);
+  free(w);
+}
+
+static StdioWriter *ctx_stdio(Context *ctx, int fd) {
+  StdioWriter **w = fd == 1 ? &ctx->stdout_w : &ctx->stderr_w;
+  if (!*w)
+    *w = writer_acquire(ctx->loop, fd);
+  return *w;
+}
+
+// Report on stderr, through the same non-blocking path as stdout.
+static void err_printf(Context *ctx, const char *fmt, ...) {
+  char buf[512];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (n <= 0)
+    return;
+  StdioWriter *w = ctx_stdio(ctx, 2);
+  writer_put(w, buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+  writer_flush(w);
+}
+
+// An output sink for words whose report goes to stderr.
+static void stderr_sink(SfContext *ctx, const char *s, size_t n,
+                        void *data) {
+  (void)data;
+  writer_put(ctx_stdio(ctx, 2), s, n);
+}
+
+// Push out what evaluation printed, at the end of a host's call.
+static void stdio_flush(Context *ctx) {
+  if (ctx->stdout_w)
+    writer_flush(ctx->stdout_w);
+}
+
+static void retired_flush(Context *ctx);
+static void retired_settle(Context *ctx, jmp_buf *outer);
+
+// Report a callback error: to the host's handler if there is one, else by
+// stopping the uv:run that is driving this context, else on stderr.
+static void callback_failed(Context *ctx) {
+  if (ctx->on_error) {
+    ctx->on_error(ctx, ctx->err, ctx->errmsg, ctx->on_error_data);
+  } else if (ctx->run_depth > 0) {
+    ctx->run_err = ctx->err;
+    uv_stop(ctx->loop);
+  } else {
+    err_printf(ctx, "solarforth: %s\n", ctx->errmsg);
+  }
 }
 
 // Typed pops keep primitive implementations short and explicit.
 static int64_t pop_int(Context *ctx) {
-  Value v = pop(&ctx->ds);
-  if (v.type != VAL_INT) {
-    fprintf(stderr, "type error: expected int\n");
-    exit(1);
-  }
+  Value v = pop(ctx, &ctx->ds);
+  if (v.type != VAL_INT)
+    fail(ctx, SF_ERR_TYPE, "type error: expected int");
   return v.as.i;
 }
 static char *pop_str_take(Context *ctx) {
-  Value v = pop(&ctx->ds);
-  if (v.type != VAL_STRING) {
-    fprintf(stderr, "type error: expected string\n");
-    exit(1);
-  }
+  Value v = pop(ctx, &ctx->ds);
+  if (v.type != VAL_STRING)
+    fail(ctx, SF_ERR_TYPE, "type error: expected string");
   return v.as.s;
 }
 
 static Quote *pop_quote(Context *ctx) {
-  Value v = pop(&ctx->ds);
-  if (v.type != VAL_QUOTE) {
-    fprintf(stderr, "type error: expected quote\n");
-    exit(1);
-  }
+  Value v = pop(ctx, &ctx->ds);
+  if (v.type != VAL_QUOTE)
+    fail(ctx, SF_ERR_TYPE, "type error: expected quote");
   return v.as.q;
 }
 static Handle *pop_handle(Context *ctx, HandleType want) {
-  Value v = pop(&ctx->ds);
-  if (v.type != VAL_HANDLE) {
-    fprintf(stderr, "type error: expected handle\n");
-    exit(1);
+  Value v = pop(ctx, &ctx->ds);
+  if (v.type != VAL_HANDLE)
+    fail(ctx, SF_ERR_TYPE, "type error: expected handle");
+  if (want != HND_NONE && v.as.h->type != want)
+    fail(ctx, SF_ERR_TYPE, "handle type mismatch");
+  return v.as.h;
+}
+
+// ---------------- Output ----------------
+// Everything the words write goes through the context's sink: stdout by
+// default, or the host's (sf_set_output), or a REPL session's buffer while
+// one of its lines runs.
+static void out_write(Context *ctx, const char *s, size_t n) {
+  if (ctx->out)
+    ctx->out(ctx, s, n, ctx->out_data);
+  else
+    writer_put(ctx_stdio(ctx, 1), s, n);
+}
+static void out_puts(Context *ctx, const char *s) {
+  out_write(ctx, s, strlen(s));
+}
+static void out_printf(Context *ctx, const char *fmt, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (n > 0)
+    out_write(ctx, buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+}
+static void out_flush(Context *ctx) {
+  if (!ctx->out)
+    writer_schedule(ctx_stdio(ctx, 1));
+}
+
+// Print a token the way it was written: strings quoted, nested quotes
+// (stored by address inside definitions) expanded.
+static void out_quote(Context *ctx, const Quote *q);
+static void out_token(Context *ctx, const char *t) {
+  if (strncmp(t, "#S:", 3) == 0) {
+    out_write(ctx, "\"", 1);
+    out_puts(ctx, t + 3);
+    out_write(ctx, "\"", 1);
+  } else if (strncmp(t, "#Q:", 3) == 0) {
+    void *ptr = NULL;
+    sscanf(t + 3, "%p", &ptr);
+    out_quote(ctx, (const Quote *)ptr);
+  } else {
+    out_puts(ctx, t);
+  }
+}
+static void out_value(Context *ctx, const Value *v);
+// A closure prints as the quote it behaves like: its captured values, its
+// tokens, then the bodies of the quotes it composes.
+static void out_quote_body(Context *ctx, const Quote *q) {
+  for (int i = 0; i < q->ncaptured; i++) {
+    out_write(ctx, " ", 1);
+    out_value(ctx, &q->captured[i]);
   }
-  if (want != HND_NONE && v.as.h->type != want) {
-    fprintf(stderr, "handle type mismatch\n");
-    exit(1);
+  for (int i = 0; i < q->count; i++) {
+    out_write(ctx, " ", 1);
+    out_token(ctx, q->tokens[i]);
+  }
+  for (int i = 0; i < 2 && q->parts[i]; i++)
+    out_quote_body(ctx, q->parts[i]);
+}
+static void out_quote(Context *ctx, const Quote *q) {
+  out_write(ctx, "[", 1);
+  if (q)
+    out_quote_body(ctx, q);
+  out_write(ctx, " ]", 2);
+}
+
+static const char *handle_kind(const Handle *h) {
+  switch (h->type) {
+  case HND_TIMER:
+    return "timer";
+  case HND_TCP:
+    return "tcp";
+  case HND_FS_EVENT:
+    return "fs-event";
+  case HND_REPL:
+    return "repl";
+  case HND_SIGNAL:
+    return "signal";
+  case HND_POLL:
+    return "poll";
+  case HND_RING:
+    return "ring";
+  default:
+    return "handle";
   }
-  return v.as.h;
 }
 
 // A handful of words used by the examples.
 static void prim_dup(Context *ctx) {
-  Value v = peek(&ctx->ds);
+  push(&ctx->ds, value_copy(ctx, peek(ctx, &ctx->ds)));
+}
+static void prim_drop(Context *ctx) { value_free(ctx, pop(ctx, &ctx->ds)); }
 
-  if (v.type == VAL_STRING)
-    v.as.s = xstrdup(v.as.s);
-  push(&ctx->ds, v);
+// curry ( x q -- q' ): a closure that pushes x, then runs q. x is captured
+// as it is now; each run pushes a fresh copy of a string.
+static void prim_curry(Context *ctx) {
+  Quote *q = pop_quote(ctx);
+  Value x = pop(ctx, &ctx->ds);
+  if (x.type == VAL_STRING) {
+    char *s = xstrdup(x.as.s);
+    str_free(ctx, x.as.s);
+    x.as.s = s;
+  }
+  Quote *c = quote_new();
+  c->captured = (Value *)xmalloc(sizeof(Value));
+  c->captured[0] = x;
+  c->ncaptured = 1;
+  c->parts[0] = q;
+  push(&ctx->ds, VQuote(c));
 }
-static void prim_drop(Context *ctx) {
-  Value v = pop(&ctx->ds);
-  if (v.type == VAL_STRING)
-    free(v.as.s);
+
+// compose ( q1 q2 -- q ): a closure that runs q1, then q2.
+static void prim_compose(Context *ctx) {
+  Quote *q2 = pop_quote(ctx);
+  Quote *q1 = pop_quote(ctx);
+  Quote *c = quote_new();
+  c->parts[0] = q1;
+  c->parts[1] = q2;
+  push(&ctx->ds, VQuote(c));
+}
+
+// call ( q -- ): run a quote or closure now.
+static void prim_call(Context *ctx) {
+  Quote *q = pop_quote(ctx);
+  jmp_buf trap;
+  jmp_buf *outer = ctx->trap;
+  ctx->trap = &trap;
+  if (setjmp(trap) != 0) {
+    ctx->trap = outer;
+    quote_release(q);
+    rethrow(ctx);
+  }
+  exec_quote(ctx, q);
+  ctx->trap = outer;
+  quote_release(q);
 }
 static void prim_cr(Context *ctx) {
-  (void)ctx;
-  printf("\n");
-  fflush(stdout);
+  out_write(ctx, "\n", 1);
+  out_flush(ctx);
 }
 static void prim_print(Context *ctx) {
   char *s = pop_str_take(ctx);
-  fputs(s, stdout);
-  free(s);
+  out_puts(ctx, s);
+  str_free(ctx, s);
+}
+static void sim_stop(Context *ctx);
+// Leave the REPL and, when called from a callback, return from uv:run.
+static void prim_bye(Context *ctx) {
+  ctx->running = false;
+  uv_stop(ctx->loop);
+  if (ctx->sim)
+    sim_stop(ctx);
 }
-static void prim_bye(Context *ctx) { ctx->running = false; }
 
-// List all defined words in the dictionary, newest first, space-separated.
+// List all defined words, space-separated: the context's own, newest first,
+// then the base context's, then the built-ins.
 static void prim_words(Context *ctx) {
-  for (Word *w = ctx->dict->head; w; w = w->next) {
-    fputs(w->name, stdout);
-    fputc(' ', stdout);
+  for (Dict *d = ctx->dict; d; d = d->parent) {
+    for (Word *w = d->head; w; w = w->next) {
+      out_puts(ctx, w->name);
+      out_write(ctx, " ", 1);
+    }
+  }
+  for (int i = 0; i < PRIM_COUNT; i++) {
+    out_puts(ctx, prim_table[i].name);
+    out_write(ctx, " ", 1);
+  }
+  out_write(ctx, "\n", 1);
+  out_flush(ctx);
+}
+
+// callback:warn ( flag -- ): report on stderr every callback that leaves
+// values on the stack, not just count them.
+static void prim_callback_warn(Context *ctx) {
+  ctx->cb_warn = pop_int(ctx) != 0;
+}
+
+static void out_value(Context *ctx, const Value *v) {
+  switch (v->type) {
+  case VAL_INT:
+    out_printf(ctx, "%lld", (long long)v->as.i);
+    break;
+  case VAL_STRING:
+    out_write(ctx, "\"", 1);
+    out_puts(ctx, v->as.s);
+    out_write(ctx, "\"", 1);
+    break;
+  case VAL_QUOTE:
+    out_quote(ctx, v->as.q);
+    break;
+  case VAL_HANDLE:
+    out_printf(ctx, "<%s %p>", handle_kind(v->as.h), (void *)v->as.h);
+    break;
+  }
+}
+
+// Show the data stack, bottom first, without changing it.
+static void prim_dot_s(Context *ctx) {
+  out_printf(ctx, "<%d>", ctx->ds.top);
+  for (int i = 0; i < ctx->ds.top; i++) {
+    out_write(ctx, " ", 1);
+    out_value(ctx, &ctx->ds.data[i]);
   }
-  fputc('\n', stdout);
-  fflush(stdout);
+  out_write(ctx, "\n", 1);
+  out_flush(ctx);
+}
+
+static void out_admission(Context *ctx, const Handle *h);
+static void out_ring(Context *ctx, const Handle *h);
+
+// List the context's live handles, newest first, with their callbacks.
+static void prim_handles(Context *ctx) {
+  for (Handle *h = ctx->handles; h; h = h->next) {
+    out_printf(ctx, "<%s %p>", handle_kind(h), (void *)h);
+    if (uv_is_closing(&h->u.base))
+      out_puts(ctx, " closing");
+    else if (uv_is_active(&h->u.base))
+      out_puts(ctx, " active");
+    if (h->path) {
+      out_write(ctx, " ", 1);
+      out_puts(ctx, h->path);
+    }
+    if (h->cached)
+      out_printf(ctx, " cached %zu%s", strlen(h->cached),
+                 h->stale ? " stale" : "");
+    out_admission(ctx, h);
+    uv_os_fd_t fd;
+    if (h->type == HND_POLL && uv_fileno(&h->u.base, &fd) == 0)
+      out_printf(ctx, " fd %d", (int)fd);
+    if (h->ring)
+      out_ring(ctx, h);
+    if (h->io)
+      out_puts(ctx, " uring");
+    if (h->rbuf)
+      out_printf(ctx, " rbuf %u%s", h->rbuf, h->rbuf_fixed ? " fixed" : "");
+    if (h->arena)
+      out_printf(ctx, " arena %zu/%zu", h->arena->live, h->arena->bytes);
+    if (h->cb1) {
+      out_write(ctx, " ", 1);
+      out_quote(ctx, h->cb1);
+    }
+    out_write(ctx, "\n", 1);
+  }
+  out_flush(ctx);
+}
+
+// The sf_stats counters, for a live look at a running script.
+static void prim_stats(Context *ctx) {
+  SfStats st;
+  sf_stats(ctx, &st);
+  out_printf(ctx,
+             "bytes %zu peak %zu cpu-us %llu handles %u out-dropped %llu "
+             "log-records %llu log-dropped %llu lag-ms %u "
+             "conn-rejected %llu stack-reclaimed %llu\n",
+             st.bytes, st.peak_bytes, (unsigned long long)(st.cpu_ns / 1000),
+             st.handles, (unsigned long long)st.out_dropped,
+             (unsigned long long)st.log_records,
+             (unsigned long long)st.log_dropped, st.loop_lag_ms,
+             (unsigned long long)st.conn_rejected,
+             (unsigned long long)st.stack_reclaimed);
+  out_flush(ctx);
 }
 
 static bool is_number(const char *t) {
@@ -502,411 +1471,3863 @@ typedef struct {
 } CompileState;
 
 // Execute a word: primitives call straight into C, colon words run quotes.
-static void exec_word(Context *ctx, Word *w) {
+// The bodies running are noted, so that reload knows which old ones it may
+// free while uv:run is still below them.
+static void exec_word(Context *ctx, const Word *w) {
   if (w->is_prim) {
     w->prim(ctx);
-  } else {
-    exec_quote(ctx, w->code);
+    return;
+  }
+  int n = ctx->nactive;
+  if (n >= ctx->active_cap) {
+    ctx->active_cap = ctx->active_cap ? ctx->active_cap * 2 : 16;
+    ctx->active = (const Quote **)realloc(
+        ctx->active, ctx->active_cap * sizeof(Quote *));
+    if (!ctx->active)
+      oom();
   }
+  ctx->active[n] = w->code;
+  ctx->nactive = n + 1;
+  exec_quote(ctx, w->code);
+  ctx->nactive = n;
 }
 
-// Timer tick: push its handle and run the stored quotation.
-static void on_timer(uv_timer_t *t) {
-  Handle *h = (Handle *)t->data;
-  if (!h || !h->cb1)
+// Drop what a callback left above its frame. Values left by one that
+// returned normally are a bug in the handler: count them, and report them
+// if asked to by callback:warn.
+static void frame_reclaim(Context *ctx, int base, const Quote *q,
+                          bool failed) {
+  int n = ctx->ds.top - base;
+  if (n <= 0)
     return;
-  Context *ctx = h->ctx;
-  push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
-  exec_quote(ctx, h->cb1);
+  for (int i = base; i < ctx->ds.top; i++)
+    value_free(ctx, ctx->ds.data[i]);
+  ctx->ds.top = base;
+  if (failed || !q)
+    return;
+  ctx->reclaimed += (uint64_t)n;
+  if (!ctx->cb_warn)
+    return;
+  SfOutputFn out = ctx->out;
+  void *out_data = ctx->out_data;
+  ctx->out = stderr_sink;
+  out_printf(ctx, "warning: callback ");
+  out_quote(ctx, q);
+  out_printf(ctx, " left %d value%s on the stack\n", n, n == 1 ? "" : "s");
+  ctx->out = out;
+  ctx->out_data = out_data;
+  writer_flush(ctx_stdio(ctx, 2));
 }
 
-// Run the libuv event loop and process pending I/O.
-static void prim_uv_run(Context *ctx) { uv_run(ctx->loop, UV_RUN_DEFAULT); }
+// libuv callbacks are error boundaries: a failing quote must never unwind
+// through libuv's own frames. Each call also gets its own frame on the data
+// stack, holding the `nargs` values just pushed for it: the quote cannot
+// pop below them, and whatever it leaves behind is dropped afterwards, so a
+// handler that leaks a value per event cannot grow the stack forever. A
+// missing quote (q is NULL) just drops the arguments.
+static void run_callback(Context *ctx, Quote *q, int nargs) {
+  int base = ctx->ds.top - nargs;
+  int floor = ctx->ds.floor;
+  volatile bool failed = false;
+  jmp_buf trap;
+  jmp_buf *outer = ctx->trap;
+  int active = ctx->nactive;
+  if (q) {
+    quote_retain(q); // the quote may replace itself, e.g. uv:timer-start
+    ctx->trap = &trap;
+    ctx->ds.floor = base;
+    meter_enter(ctx);
+    if (setjmp(trap) == 0) {
+      exec_quote(ctx, q);
+      meter_leave(ctx);
+    } else {
+      meter_leave(ctx);
+      failed = true;
+      callback_failed(ctx);
+    }
+    ctx->ds.floor = floor;
+    ctx->trap = outer;
+    ctx->nactive = active;
+  }
+  frame_reclaim(ctx, base, q, failed);
+  quote_release(q);
+  retired_settle(ctx, outer);
+}
 
-static void prim_uv_timer(Context *ctx) {
-  Handle *h = handle_new(ctx, HND_TIMER);
-  uv_timer_init(ctx->loop, &h->u.timer);
-  h->u.timer.data = h;
+// Timer tick: push its handle and run the stored quotation.
+static void timer_fire(Handle *h) {
+  if (!h->cb1)
+    return;
+  Context *ctx = h->ctx;
   push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+  run_callback(ctx, h->cb1, 1);
 }
-static void prim_uv_timer_start(Context *ctx) {
-  Quote *q = pop_quote(ctx);
-  int64_t repeat = pop_int(ctx);
-  int64_t timeout = pop_int(ctx);
-  Handle *h = pop_handle(ctx, HND_TIMER);
-  if (h->cb1)
-    quote_free(h->cb1);
-  h->cb1 = q;
-  int rc = uv_timer_start(&h->u.timer, on_timer, (uint64_t)timeout,
-                          (uint64_t)repeat);
-  if (rc) {
-    fprintf(stderr, "uv_timer_start: %s\n", uv_strerror(rc));
-  }
+static void on_timer(uv_timer_t *t) {
+  Handle *h = (Handle *)t->data;
+  if (h)
+    timer_fire(h);
 }
-static void prim_uv_timer_stop(Context *ctx) {
-  Handle *h = pop_handle(ctx, HND_TIMER);
-  int rc = uv_timer_stop(&h->u.timer);
-  if (rc) {
-    fprintf(stderr, "uv_timer_stop: %s\n", uv_strerror(rc));
+
+// h's arena, made on first use; NULL without uv:arena.
+static Arena *handle_arena(Handle *h) {
+  if (h->use_arena && !h->arena) {
+    h->arena = (Arena *)xcalloc(1, sizeof(Arena));
+    h->arena->ctx = h->ctx;
   }
+  return h->arena;
 }
 
-static void on_close_free(uv_handle_t *handle) {
-  Handle *h = (Handle *)handle->data;
-  handle_free(h);
+// Run a callback for connection h with strings coming from its arena.
+static void run_in_arena(Handle *h, Quote *q, int nargs) {
+  Context *ctx = h->ctx;
+  Arena *outer = ctx->arena;
+  ctx->arena = handle_arena(h);
+  run_callback(ctx, q, nargs);
+  ctx->arena = outer;
 }
-static void prim_uv_close(Context *ctx) {
-  Handle *h = pop_handle(ctx, HND_NONE);
-  uv_close(&h->u.base, on_close_free);
+
+// A string for what h read, from its arena like those its callbacks make.
+static char *read_alloc(Handle *h, size_t len) {
+  Context *ctx = h->ctx;
+  Arena *outer = ctx->arena;
+  ctx->arena = handle_arena(h);
+  char *s = str_alloc(ctx, len);
+  ctx->arena = outer;
+  return s;
 }
 
-// Create a TCP handle and push it.
-static void prim_uv_tcp(Context *ctx) {
-  Handle *h = handle_new(ctx, HND_TCP);
-  uv_tcp_init(ctx->loop, &h->u.tcp);
-  h->u.tcp.data = h;
-  push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+// Hand received bytes to the stream's quote as ( h str ); "" means EOF.
+static void stream_deliver(Handle *h, char *s) {
+  push(&h->ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+  push(&h->ctx->ds, VStrTake(s));
+  run_in_arena(h, h->cb1, 2);
 }
-static void prim_uv_tcp_bind(Context *ctx) {
-  int64_t port = pop_int(ctx);
+
+// Run a listener's quote with a newly accepted client.
+static void accept_deliver(Handle *hs, Handle *hc) {
+  push(&hs->ctx->ds, (Value){.type = VAL_HANDLE, .as.h = hc});
+  hc->use_arena = hs->use_arena;
+  run_in_arena(hc, hs->cb1, 1);
+}
+
+// Run a connecting stream's quote once it is connected.
+static void connect_deliver(Handle *h) {
+  push(&h->ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+  run_in_arena(h, h->cb1, 1);
+}
+
+// ---------------- Introspection ----------------
+
+// see ( name -- ): print a word as it is compiled. Words its body names that
+// are not defined right now are marked with a "?"; they are looked up again
+// each time the body runs.
+static void prim_see(Context *ctx) {
+  char *name = pop_str_take(ctx);
+  const Word *w = dict_lookup(ctx->dict, name);
+  if (!w) {
+    char msg[160];
+    snprintf(msg, sizeof(msg), "%s", name);
+    str_free(ctx, name);
+    fail(ctx, SF_ERR_UNKNOWN_WORD, "unknown word: %s", msg);
+  }
+  if (w->is_prim) {
+    out_printf(ctx, "%s is a primitive\n", name);
+  } else {
+    out_printf(ctx, ": %s", name);
+    for (int i = 0; i < w->code->count; i++) {
+      const char *t = w->code->tokens[i];
+      out_write(ctx, " ", 1);
+      out_token(ctx, t);
+      if (t[0] != '#' && !is_number(t) && !dict_lookup(ctx->dict, t))
+        out_write(ctx, "?", 1);
+    }
+    out_puts(ctx, " ;\n");
+  }
+  str_free(ctx, name);
+  out_flush(ctx);
+}
+
+#define BENCH_WARMUP_MAX 1000
+
+// bench ( q n -- ns ): run q n times after a warmup of n/10 runs (at most
+// BENCH_WARMUP_MAX), print the mean and fastest time per run, and push the
+// mean in nanoseconds. Each run gets a fresh frame, like a callback: what q
+// leaves behind is dropped, so it runs against the same stack every time.
+static void prim_bench(Context *ctx) {
+  int64_t n = pop_int(ctx);
+  Quote *q = pop_quote(ctx);
+  int base = ctx->ds.top;
+  int floor = ctx->ds.floor;
+  jmp_buf trap;
+  jmp_buf *outer = ctx->trap;
+  ctx->trap = &trap;
+  if (setjmp(trap) != 0) {
+    ctx->ds.floor = floor;
+    ctx->trap = outer;
+    frame_reclaim(ctx, base, NULL, true);
+    quote_release(q);
+    rethrow(ctx);
+  }
+  ctx->ds.floor = base;
+  int64_t warmup = n / 10 < BENCH_WARMUP_MAX ? n / 10 : BENCH_WARMUP_MAX;
+  for (int64_t i = 0; i < warmup; i++) {
+    exec_quote(ctx, q);
+    frame_reclaim(ctx, base, NULL, true);
+  }
+  uint64_t total = 0, best = UINT64_MAX;
+  for (int64_t i = 0; i < n; i++) {
+    uint64_t t0 = uv_hrtime();
+    exec_quote(ctx, q);
+    uint64_t dt = uv_hrtime() - t0;
+    frame_reclaim(ctx, base, NULL, true);
+    total += dt;
+    if (dt < best)
+      best = dt;
+  }
+  ctx->ds.floor = floor;
+  ctx->trap = outer;
+  quote_release(q);
+  uint64_t mean = n > 0 ? total / (uint64_t)n : 0;
+  out_printf(ctx, "bench: %lld runs, mean %llu ns, min %llu ns\n",
+             (long long)(n > 0 ? n : 0), (unsigned long long)mean,
+             (unsigned long long)(n > 0 ? best : 0));
+  out_flush(ctx);
+  push(&ctx->ds, VInt((int64_t)mean));
+}
+
+// ---------------- Admission control ----------------
+// A listener can cap its concurrent connections (uv:listen-limit) and shed
+// new ones while the loop is lagging (uv:listen-shed). At the cap a
+// connection is either closed as soon as it is accepted, or left waiting:
+// libuv stops polling a listener whose connection callback did not accept,
+// so the rest stay in the kernel's backlog until a slot frees up and we
+// accept again. Accepted connections hold a reference to their listener's
+// Admission, which outlives whichever of them closes first. A connection
+// gives its slot back when it closes or when its peer hangs up, whichever
+// comes first.
+
+#define LAG_PROBE_MS 50
+
+typedef struct Admission {
+  int refs;
+  Handle *listener; // NULL once the listener is gone
+  int max;          // concurrent connections, 0 = unlimited
+  bool pause;       // at the cap: wait in the backlog instead of closing
+  bool pending;     // libuv holds a connection we did not accept yet
+  Handle **held;    // accepted connections waiting for a slot
+  int nheld, held_cap;
+  uint32_t shed_lag_ms; // shed while the loop lags more; 0 = never
+  int active;
+  uint64_t accepted, rejected, shed;
+} Admission;
+
+typedef enum { ADMIT, REFUSE, WAIT } AdmitDecision;
+
+static AdmitDecision admit(Handle *hs) {
+  Admission *a = hs->adm;
+  if (!a)
+    return ADMIT;
+  Context *ctx = hs->ctx;
+  if (a->shed_lag_ms && ctx->lag_ms > a->shed_lag_ms) {
+    a->shed++;
+    ctx->conn_rejected++;
+    return REFUSE;
+  }
+  if (a->max && a->active >= a->max) {
+    if (a->pause)
+      return WAIT;
+    a->rejected++;
+    ctx->conn_rejected++;
+    return REFUSE;
+  }
+  return ADMIT;
+}
+
+static void admitted(Handle *hs, Handle *hc) {
+  Admission *a = hs->adm;
+  if (!a)
+    return;
+  hc->adm = a;
+  a->refs++;
+  a->active++;
+  a->accepted++;
+}
+
+static void accept_next(Handle *hs, bool refuse);
+static void handle_close(Context *ctx, Handle *h);
+
+// Hand queued connections to the listener while there is room.
+static void admission_resume(Admission *a) {
+  Handle *hs = a->listener;
+  if (!hs || !hs->ctx || uv_is_closing(&hs->u.base))
+    return;
+  AdmitDecision d;
+  if (a->pending && (d = admit(hs)) != WAIT) {
+    a->pending = false;
+    accept_next(hs, d == REFUSE);
+  }
+  while (a->nheld > 0 && (d = admit(hs)) != WAIT) {
+    Handle *hc = a->held[0];
+    memmove(a->held, a->held + 1, --a->nheld * sizeof(Handle *));
+    if (d == REFUSE) {
+      handle_close(hs->ctx, hc);
+    } else {
+      admitted(hs, hc);
+      accept_deliver(hs, hc);
+    }
+  }
+}
+
+// A connection accepted before admission (simulated, or by io_uring):
+// deliver it, close it, or hold it until a slot frees up.
+static void admit_accepted(Context *ctx, Handle *hs, Handle *hc) {
+  AdmitDecision d = admit(hs);
+  if (d == REFUSE) {
+    handle_close(ctx, hc);
+  } else if (d == WAIT) {
+    Admission *a = hs->adm;
+    if (a->nheld >= a->held_cap) {
+      a->held_cap = a->held_cap ? a->held_cap * 2 : 8;
+      a->held = (Handle **)realloc(a->held, a->held_cap * sizeof(Handle *));
+      if (!a->held)
+        oom();
+    }
+    a->held[a->nheld++] = hc;
+  } else {
+    admitted(hs, hc);
+    accept_deliver(hs, hc);
+  }
+}
+
+// Called from handle_free for listeners and their connections, and at EOF
+// for connections.
+static void admission_leave(Handle *h) {
+  Admission *a = h->adm;
+  h->adm = NULL;
+  if (a->listener == h) {
+    a->listener = NULL;
+    for (int i = 0; i < a->nheld; i++)
+      if (h->ctx && !uv_is_closing(&a->held[i]->u.base))
+        handle_close(h->ctx, a->held[i]);
+    a->nheld = 0;
+  } else {
+    a->active--;
+    admission_resume(a);
+  }
+  if (--a->refs == 0) {
+    free(a->held);
+    free(a);
+  }
+}
+
+// The peer of connection h hung up: it no longer counts against the
+// listener's limit, nor holds up a drain, even if the script keeps it open.
+static void stream_ended(Handle *h) {
+  h->eof = true;
+  if (h->adm)
+    admission_leave(h);
+  drain_check(h->ctx);
+}
+
+static Admission *admission(Handle *hs) {
+  if (!hs->adm) {
+    hs->adm = (Admission *)xcalloc(1, sizeof(Admission));
+    hs->adm->refs = 1;
+    hs->adm->listener = hs;
+  }
+  return hs->adm;
+}
+
+static void out_admission(Context *ctx, const Handle *h) {
+  Admission *a = h->adm;
+  if (!a || a->listener != h)
+    return;
+  out_printf(ctx, " conns %d/%d accepted %llu rejected %llu shed %llu%s",
+             a->active, a->max, (unsigned long long)a->accepted,
+             (unsigned long long)a->rejected, (unsigned long long)a->shed,
+             a->pending || a->nheld ? " waiting" : "");
+}
+
+// Loop lag: how late a repeating timer fires. It rises at once and decays
+// over a few probes.
+static void on_lag_probe(uv_timer_t *t) {
+  Context *ctx = (Context *)t->data;
+  uint64_t now = uv_hrtime();
+  uint32_t sample =
+      now > ctx->lag_due ? (uint32_t)((now - ctx->lag_due) / 1000000) : 0;
+  ctx->lag_ms = sample > ctx->lag_ms ? sample : (ctx->lag_ms * 3 + sample) / 4;
+  ctx->lag_due = now + (uint64_t)LAG_PROBE_MS * 1000000;
+}
+
+static void lag_probe_start(Context *ctx) {
+  if (ctx->lag_timer || ctx->sim) // virtual time never lags
+    return;
+  ctx->lag_timer = (uv_timer_t *)xmalloc(sizeof(uv_timer_t));
+  uv_timer_init(ctx->loop, ctx->lag_timer);
+  ctx->lag_timer->data = ctx;
+  ctx->lag_due = uv_hrtime() + (uint64_t)LAG_PROBE_MS * 1000000;
+  uv_timer_start(ctx->lag_timer, on_lag_probe, LAG_PROBE_MS, LAG_PROBE_MS);
+  uv_unref((uv_handle_t *)ctx->lag_timer);
+}
+
+// uv:listen-limit ( h max policy -- ): at most max connections from this
+// listener at a time. Past that, policy "close" closes new connections as
+// they arrive; "pause" stops accepting until one of them closes.
+static void prim_uv_listen_limit(Context *ctx) {
+  char *policy = pop_str_take(ctx);
+  bool pause = strcmp(policy, "pause") == 0;
+  bool known = pause || strcmp(policy, "close") == 0;
+  str_free(ctx, policy);
+  int64_t max = pop_int(ctx);
+  Handle *h = pop_handle(ctx, HND_TCP);
+  if (!known)
+    fail(ctx, SF_ERR_TYPE, "uv:listen-limit: policy is \"close\" or \"pause\"");
+  Admission *a = admission(h);
+  a->max = max > 0 ? (int)max : 0;
+  a->pause = pause;
+  admission_resume(a);
+}
+
+// uv:listen-shed ( h lag-ms -- ): close new connections at once while the
+// loop runs more than lag-ms behind (0 turns shedding off).
+static void prim_uv_listen_shed(Context *ctx) {
+  int64_t ms = pop_int(ctx);
+  Handle *h = pop_handle(ctx, HND_TCP);
+  admission(h)->shed_lag_ms = ms > 0 ? (uint32_t)ms : 0;
+  lag_probe_start(ctx);
+}
+
+// ---------------- Simulation ----------------
+// In a simulated context (sf_simulate, `solarforth --sim`) timers run on a
+// virtual clock and TCP handles are in-memory loopback streams. uv:run pops
+// events in (time, sequence) order and jumps the clock straight to each
+// one, so hours of timeouts take no real time and every run of a script
+// sees the same interleaving. The handles still own real (never started)
+// libuv handles so that uv:close and teardown work unchanged.
+typedef enum {
+  SIM_TIMER,   // h's timer is due
+  SIM_ACCEPT,  // listener h accepts peer
+  SIM_CONNECT, // h finished connecting
+  SIM_DATA,    // h has bytes (or an EOF) to read
+} SimEventKind;
+
+typedef struct {
+  uint64_t at;  // virtual ms
+  uint64_t seq; // tie-break: events at the same time run in order
+  SimEventKind kind;
+  Handle *h;
+  Handle *peer;
+} SimEvent;
+
+struct Sim {
+  uint64_t now; // virtual ms since the context started
+  uint64_t seq;
+  SimEvent *q;  // binary min-heap on (at, seq)
+  int count;
+  int cap;
+  bool stopped; // set by bye
+};
+
+struct SimHandle {
+  uint64_t repeat;         // timers: period in ms, 0 for one-shot
+  struct sockaddr_in addr; // bound address
+  bool bound;
+  bool listening;
+  bool reading;
+  bool data_queued; // a SIM_DATA event is pending
+  bool eof;         // the peer closed; EOF not yet delivered
+  Handle *peer;     // the other end of a connected stream
+  char *inbox;      // bytes written by the peer, not yet read
+  size_t len;
+  size_t cap;
+};
+
+static bool sim_before(const SimEvent *a, const SimEvent *b) {
+  return a->at < b->at || (a->at == b->at && a->seq < b->seq);
+}
+static void sim_sift_down(Sim *sim, int i) {
+  for (;;) {
+    int l = 2 * i + 1, r = l + 1, m = i;
+    if (l < sim->count && sim_before(&sim->q[l], &sim->q[m]))
+      m = l;
+    if (r < sim->count && sim_before(&sim->q[r], &sim->q[m]))
+      m = r;
+    if (m == i)
+      return;
+    SimEvent t = sim->q[i];
+    sim->q[i] = sim->q[m];
+    sim->q[m] = t;
+    i = m;
+  }
+}
+static void sim_schedule(Sim *sim, uint64_t delay, SimEventKind kind,
+                         Handle *h, Handle *peer) {
+  if (sim->count >= sim->cap) {
+    sim->cap = sim->cap ? sim->cap * 2 : 64;
+    sim->q = (SimEvent *)realloc(sim->q, sim->cap * sizeof(SimEvent));
+    if (!sim->q)
+      oom();
+  }
+  int i = sim->count++;
+  sim->q[i] = (SimEvent){sim->now + delay, sim->seq++, kind, h, peer};
+  while (i > 0 && sim_before(&sim->q[i], &sim->q[(i - 1) / 2])) {
+    SimEvent t = sim->q[i];
+    sim->q[i] = sim->q[(i - 1) / 2];
+    sim->q[(i - 1) / 2] = t;
+    i = (i - 1) / 2;
+  }
+}
+static bool sim_pop(Sim *sim, SimEvent *out) {
+  if (sim->count == 0)
+    return false;
+  *out = sim->q[0];
+  sim->q[0] = sim->q[--sim->count];
+  sim_sift_down(sim, 0);
+  return true;
+}
+// Drop pending events that mention h (of any kind when kind < 0).
+static void sim_cancel(Sim *sim, Handle *h, int kind) {
+  int n = 0;
+  for (int i = 0; i < sim->count; i++) {
+    SimEvent *e = &sim->q[i];
+    bool match = (e->h == h || e->peer == h) &&
+                 (kind < 0 || (int)e->kind == kind);
+    if (!match)
+      sim->q[n++] = *e;
+  }
+  sim->count = n;
+  for (int i = n / 2 - 1; i >= 0; i--)
+    sim_sift_down(sim, i);
+}
+
+static SimHandle *sim_handle(Handle *h) {
+  if (!h->sim)
+    h->sim = (SimHandle *)xcalloc(1, sizeof(SimHandle));
+  return h->sim;
+}
+static void sim_handle_free(SimHandle *sh) {
+  if (!sh)
+    return;
+  free(sh->inbox);
+  free(sh);
+}
+
+static void sim_timer_start(Context *ctx, Handle *h, uint64_t timeout,
+                            uint64_t repeat) {
+  sim_cancel(ctx->sim, h, SIM_TIMER);
+  sim_handle(h)->repeat = repeat;
+  sim_schedule(ctx->sim, timeout, SIM_TIMER, h, NULL);
+}
+
+static void sim_bind(Context *ctx, Handle *h, const struct sockaddr_in *addr) {
+  (void)ctx;
+  SimHandle *sh = sim_handle(h);
+  sh->addr = *addr;
+  sh->bound = true;
+}
+
+static Handle *sim_find_listener(Context *ctx,
+                                 const struct sockaddr_in *addr) {
+  for (Handle *h = ctx->handles; h; h = h->next) {
+    SimHandle *sh = h->sim;
+    if (sh && sh->listening && sh->addr.sin_port == addr->sin_port &&
+        (sh->addr.sin_addr.s_addr == addr->sin_addr.s_addr ||
+         sh->addr.sin_addr.s_addr == htonl(INADDR_ANY)))
+      return h;
+  }
+  return NULL;
+}
+
+static void sim_listen(Context *ctx, Handle *h) {
+  SimHandle *sh = sim_handle(h);
+  if (!sh->bound)
+    fail(ctx, SF_ERR_UV, "uv_listen: %s", uv_strerror(UV_EINVAL));
+  if (sim_find_listener(ctx, &sh->addr))
+    fail(ctx, SF_ERR_UV, "uv_listen: %s", uv_strerror(UV_EADDRINUSE));
+  sh->listening = true;
+}
+
+// Connecting pairs h with a fresh server-side stream at once; the listener
+// sees the accept first, then the client its connect. With no listener the
+// connect is refused, which (as with real sockets) runs no quote.
+static void sim_connect(Context *ctx, Handle *h,
+                        const struct sockaddr_in *dest) {
+  Handle *hs = sim_find_listener(ctx, dest);
+  if (!hs)
+    return;
+  Handle *hc = handle_new(ctx, HND_TCP);
+  uv_tcp_init(ctx->loop, &hc->u.tcp);
+  hc->u.tcp.data = hc;
+  sim_handle(hc)->peer = h;
+  sim_handle(h)->peer = hc;
+  sim_schedule(ctx->sim, 0, SIM_ACCEPT, hs, hc);
+  sim_schedule(ctx->sim, 0, SIM_CONNECT, h, NULL);
+}
+
+static void sim_queue_data(Context *ctx, Handle *h) {
+  SimHandle *sh = h->sim;
+  if (sh->reading && !sh->data_queued && (sh->len > 0 || sh->eof)) {
+    sh->data_queued = true;
+    sim_schedule(ctx->sim, 0, SIM_DATA, h, NULL);
+  }
+}
+
+static void sim_write(Context *ctx, Handle *h, const char *s) {
+  Handle *peer = sim_handle(h)->peer;
+  if (!peer)
+    return; // not connected, or the peer is gone
+  SimHandle *ph = peer->sim;
+  size_t n = strlen(s);
+  if (ph->len + n > ph->cap) {
+    ph->cap = (ph->len + n) * 2;
+    ph->inbox = (char *)realloc(ph->inbox, ph->cap);
+    if (!ph->inbox)
+      oom();
+  }
+  memcpy(ph->inbox + ph->len, s, n);
+  ph->len += n;
+  sim_queue_data(ctx, peer);
+}
+
+static void sim_read_start(Context *ctx, Handle *h) {
+  sim_handle(h)->reading = true;
+  sim_queue_data(ctx, h);
+}
+
+// Closing drops h's pending events and gives the peer an EOF after any
+// bytes it has not read yet.
+static void sim_close(Context *ctx, Handle *h) {
+  sim_cancel(ctx->sim, h, -1);
+  SimHandle *sh = h->sim;
+  if (!sh || !sh->peer)
+    return;
+  SimHandle *ph = sh->peer->sim;
+  ph->peer = NULL;
+  ph->eof = true;
+  sim_queue_data(ctx, sh->peer);
+  sh->peer = NULL;
+}
+
+// The server side of a simulated connection already exists; admission
+// control decides whether the listener sees it now, later or never.
+
+static void sim_dispatch(Context *ctx, const SimEvent *e) {
+  Handle *h = e->h;
+  SimHandle *sh = h->sim;
+  switch (e->kind) {
+  case SIM_TIMER:
+    if (sh->repeat)
+      sim_schedule(ctx->sim, sh->repeat, SIM_TIMER, h, NULL);
+    timer_fire(h);
+    break;
+  case SIM_ACCEPT:
+    admit_accepted(ctx, h, e->peer);
+    break;
+  case SIM_CONNECT:
+    connect_deliver(h);
+    break;
+  case SIM_DATA:
+    sh->data_queued = false;
+    if (!sh->reading)
+      break;
+    if (sh->len > 0) {
+      char *s = read_alloc(h, sh->len);
+      memcpy(s, sh->inbox, sh->len);
+      sh->len = 0;
+      stream_deliver(h, s);
+      sim_queue_data(ctx, h); // an EOF may still be due
+    } else if (sh->eof) {
+      sh->eof = false;
+      sh->reading = false;
+      stream_deliver(h, read_alloc(h, 0));
+      stream_ended(h);
+    }
+    break;
+  }
+}
+
+static void sim_stop(Context *ctx) { ctx->sim->stopped = true; }
+
+// uv:run for a simulated context. The real loop still turns (without
+// blocking while events are pending) so that closes complete.
+static void sim_run(Context *ctx) {
+  Sim *sim = ctx->sim;
+  sim->stopped = false;
+  for (;;) {
+    uv_run(ctx->loop, UV_RUN_NOWAIT);
+    if (ctx->run_err || sim->stopped)
+      break;
+    SimEvent e;
+    if (!sim_pop(sim, &e)) {
+      if (!uv_loop_alive(ctx->loop))
+        break;
+      uv_run(ctx->loop, UV_RUN_ONCE);
+      continue;
+    }
+    sim->now = e.at;
+    sim_dispatch(ctx, &e);
+  }
+}
+
+// Run the libuv event loop and process pending I/O. A callback error stops
+// the loop and is re-raised here. Inside the loop already (a callback, or a
+// REPL session's line) there is nothing to do: libuv loops don't nest.
+static void prim_uv_run(Context *ctx) {
+  if (ctx->run_depth > 0)
+    return;
+  int depth = ctx->meter_depth;
+  if (depth > 0)
+    ctx->cpu_ns += uv_hrtime() - ctx->cpu_start;
+  ctx->meter_depth = 0;
+  ctx->run_depth++;
+  ctx->run_trap = ctx->trap;
+  ctx->run_active = ctx->nactive;
+  if (ctx->sim)
+    sim_run(ctx);
+  else
+    uv_run(ctx->loop, UV_RUN_DEFAULT);
+  ctx->run_trap = NULL;
+  ctx->run_active = 0;
+  ctx->run_depth--;
+  ctx->meter_depth = depth;
+  ctx->cpu_start = uv_hrtime();
+  if (ctx->run_err) {
+    ctx->err = ctx->run_err;
+    ctx->run_err = 0;
+    rethrow(ctx);
+  }
+}
+
+// Current loop time in ms (virtual time when simulated).
+static void prim_uv_now(Context *ctx) {
+  uint64_t now = ctx->sim ? ctx->sim->now : uv_now(ctx->loop);
+  push(&ctx->ds, VInt((int64_t)now));
+}
+
+static void prim_uv_timer(Context *ctx) {
+  Handle *h = handle_new(ctx, HND_TIMER);
+  uv_timer_init(ctx->loop, &h->u.timer);
+  h->u.timer.data = h;
+  push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+}
+static void prim_uv_timer_start(Context *ctx) {
+  Quote *q = pop_quote(ctx);
+  int64_t repeat = pop_int(ctx);
+  int64_t timeout = pop_int(ctx);
+  Handle *h = pop_handle(ctx, HND_TIMER);
+  if (h->cb1)
+    quote_release(h->cb1);
+  h->cb1 = q;
+  if (ctx->sim) {
+    sim_timer_start(ctx, h, (uint64_t)timeout, (uint64_t)repeat);
+    return;
+  }
+  int rc = uv_timer_start(&h->u.timer, on_timer, (uint64_t)timeout,
+                          (uint64_t)repeat);
+  if (rc)
+    fail(ctx, SF_ERR_UV, "uv_timer_start: %s", uv_strerror(rc));
+}
+static void prim_uv_timer_stop(Context *ctx) {
+  Handle *h = pop_handle(ctx, HND_TIMER);
+  if (ctx->sim) {
+    sim_cancel(ctx->sim, h, SIM_TIMER);
+    return;
+  }
+  int rc = uv_timer_stop(&h->u.timer);
+  if (rc)
+    fail(ctx, SF_ERR_UV, "uv_timer_stop: %s", uv_strerror(rc));
+}
+
+static void on_close_free(uv_handle_t *handle) {
+  Handle *h = (Handle *)handle->data;
+  handle_free(h);
+}
+static void handle_close(Context *ctx, Handle *h) {
+  if (ctx->sim)
+    sim_close(ctx, h);
+  if (h->io)
+    uring_detach(ctx, h);
+  uv_close(&h->u.base, on_close_free);
+}
+static void prim_uv_close(Context *ctx) {
+  handle_close(ctx, pop_handle(ctx, HND_NONE));
+}
+
+// handle:data! ( h x -- ): keep x on the handle, replacing what was there,
+// until it closes. Scripts hang per-connection state here.
+static void prim_handle_data_store(Context *ctx) {
+  Value x = pop(ctx, &ctx->ds);
+  Handle *h;
+  jmp_buf trap;
+  jmp_buf *outer = ctx->trap;
+  ctx->trap = &trap;
+  if (setjmp(trap) != 0) { // not a handle: don't leak x
+    ctx->trap = outer;
+    value_free(ctx, x);
+    rethrow(ctx);
+  }
+  h = pop_handle(ctx, HND_NONE);
+  ctx->trap = outer;
+  if (x.type == VAL_STRING)
+    x.as.s = str_escape(ctx, x.as.s, NULL);
+  value_free(ctx, h->data);
+  h->data = x;
+}
+
+// handle:data@ ( h -- x ): what handle:data! stored, or 0.
+static void prim_handle_data_fetch(Context *ctx) {
+  Handle *h = pop_handle(ctx, HND_NONE);
+  push(&ctx->ds, value_copy(ctx, h->data));
+}
+
+// Create a TCP handle and push it.
+static void prim_uv_tcp(Context *ctx) {
+  Handle *h = handle_new(ctx, HND_TCP);
+  uv_tcp_init(ctx->loop, &h->u.tcp);
+  h->u.tcp.data = h;
+  push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+}
+static void worker_bind(Context *ctx, Handle *h,
+                        const struct sockaddr_in *addr);
+
+static void prim_uv_tcp_bind(Context *ctx) {
+  int64_t port = pop_int(ctx);
   char *ip = pop_str_take(ctx);
   Handle *h = pop_handle(ctx, HND_TCP);
   struct sockaddr_in addr;
   uv_ip4_addr(ip, (int)port, &addr);
-  free(ip);
+  str_free(ctx, ip);
+  if (ctx->sim) {
+    sim_bind(ctx, h, &addr);
+    return;
+  }
+  if (ctx->worker) {
+    worker_bind(ctx, h, &addr);
+    return;
+  }
   int rc = uv_tcp_bind(&h->u.tcp, (const struct sockaddr *)&addr, 0);
-  if (rc) {
-    fprintf(stderr, "uv_tcp_bind: %s\n", uv_strerror(rc));
+  if (rc)
+    fail(ctx, SF_ERR_UV, "uv_tcp_bind: %s", uv_strerror(rc));
+}
+
+// Provide a buffer to libuv’s read machinery.
+static void on_alloc(uv_handle_t *handle, size_t suggested_size,
+                     uv_buf_t *buf) {
+  Handle *h = (Handle *)handle->data;
+  buf->base = (char *)malloc(suggested_size);
+  buf->len = buf->base ? suggested_size : 0;
+  mem_charge(h->ctx, buf->len);
+}
+
+static void on_write(uv_write_t *req, int status) {
+  Handle *h = (Handle *)req->handle->data;
+  mem_release(h->ctx, sizeof(uv_write_t));
+  str_free(h->ctx, (char *)req->data);
+  free(req);
+  if (status < 0) { /* ignore */
+  }
+}
+
+// ---- Batched reads ----
+// With uv:read-batch, what a stream reads during one poll phase is collected
+// and handed to its quote once, from a check handle that runs right after
+// polling: a client pipelining many small requests costs one interpreter
+// entry per loop iteration instead of one per read. The quote sees the
+// reads concatenated, then "" after them at EOF.
+typedef struct Batch {
+  bool on;
+  bool queued; // on ctx->batch_pending
+  bool eof;
+  char *buf;
+  size_t len, cap;
+  Handle *next;
+} Batch;
+
+static void on_batch_check(uv_check_t *check) {
+  Context *ctx = (Context *)check->data;
+  Handle *h = ctx->batch_pending;
+  ctx->batch_pending = NULL;
+  uv_check_stop(check);
+  while (h) {
+    Batch *b = h->batch;
+    Handle *next = b->next;
+    b->next = NULL;
+    b->queued = false;
+    if (b->len) {
+      char *s = read_alloc(h, b->len);
+      memcpy(s, b->buf, b->len);
+      mem_release(ctx, b->len);
+      b->len = 0;
+      if (!uv_is_closing(&h->u.base))
+        stream_deliver(h, s);
+      else
+        str_free(ctx, s);
+    }
+    if (b->eof) {
+      b->eof = false;
+      if (!uv_is_closing(&h->u.base))
+        stream_deliver(h, read_alloc(h, 0));
+    }
+    h = next;
+  }
+}
+
+// Keep a read (or EOF, when n is 0) for this iteration's delivery.
+static void batch_add(Handle *h, const char *data, size_t n) {
+  Context *ctx = h->ctx;
+  Batch *b = h->batch;
+  if (n == 0) {
+    b->eof = true;
+  } else {
+    if (b->len + n > b->cap) {
+      size_t cap = b->cap ? b->cap : 4096;
+      while (cap < b->len + n)
+        cap *= 2;
+      b->buf = (char *)realloc(b->buf, cap);
+      if (!b->buf)
+        oom();
+      b->cap = cap;
+    }
+    memcpy(b->buf + b->len, data, n);
+    b->len += n;
+    mem_charge(ctx, n);
+  }
+  if (b->queued)
+    return;
+  b->queued = true;
+  b->next = ctx->batch_pending;
+  ctx->batch_pending = h;
+  if (!ctx->batch_check) {
+    ctx->batch_check = (uv_check_t *)xmalloc(sizeof(uv_check_t));
+    uv_check_init(ctx->loop, ctx->batch_check);
+    ctx->batch_check->data = ctx;
+    uv_unref((uv_handle_t *)ctx->batch_check);
+  }
+  uv_check_start(ctx->batch_check, on_batch_check);
+}
+
+static void batch_free(Context *ctx, Handle *h) {
+  Batch *b = h->batch;
+  if (!b)
+    return;
+  if (b->queued && ctx) {
+    Handle **p = &ctx->batch_pending;
+    while (*p != h)
+      p = &(*p)->batch->next;
+    *p = b->next;
+  }
+  mem_release(ctx, b->len);
+  free(b->buf);
+  free(b);
+}
+
+// uv:read-batch ( h flag -- ): deliver h's reads once per loop iteration
+// (flag nonzero) or as they arrive (0, the default).
+static void prim_uv_read_batch(Context *ctx) {
+  bool on = pop_int(ctx) != 0;
+  Handle *h = pop_handle(ctx, HND_TCP);
+  if (!h->batch)
+    h->batch = (Batch *)xcalloc(1, sizeof(Batch));
+  h->batch->on = on;
+}
+
+// ---- Read buffers ----
+// Each read goes straight into a string of the handle's buffer size. A read
+// that fills at least half of it is delivered as that string, with no copy;
+// a smaller one is copied out so it does not pin the whole buffer. Unless
+// uv:read-buffer fixes the size, it adapts to the traffic: it doubles after
+// a read that fills it and halves after a run of reads that use under a
+// quarter, so chatty connections read into small buffers and bulk ones
+// into libuv's usual 64 KiB.
+#define READ_BUF_MIN 256
+#define READ_BUF_START 4096
+#define READ_BUF_MAX 65536
+#define READ_BUF_SHRINK_AFTER 4
+
+static void on_read_alloc(uv_handle_t *handle, size_t suggested_size,
+                          uv_buf_t *buf) {
+  (void)suggested_size;
+  Handle *h = (Handle *)handle->data;
+  if (!h->rbuf)
+    h->rbuf = READ_BUF_START;
+  buf->base = read_alloc(h, h->rbuf);
+  buf->len = h->rbuf;
+}
+
+static void read_buf_adapt(Handle *h, size_t nread) {
+  if (h->rbuf_fixed)
+    return;
+  if (nread >= h->rbuf && h->rbuf < READ_BUF_MAX) {
+    h->rbuf *= 2;
+    h->rbuf_small = 0;
+  } else if (nread < h->rbuf / 4 && h->rbuf > READ_BUF_MIN) {
+    if (++h->rbuf_small >= READ_BUF_SHRINK_AFTER) {
+      h->rbuf /= 2;
+      h->rbuf_small = 0;
+    }
+  } else {
+    h->rbuf_small = 0;
+  }
+}
+
+// The string to deliver for n bytes read into buf, which it consumes.
+static char *read_string(Handle *h, char *buf, size_t n, size_t cap) {
+  if (n >= cap / 2) {
+    buf[n] = '\0';
+    return buf;
+  }
+  char *s = read_alloc(h, n);
+  memcpy(s, buf, n);
+  str_free(h->ctx, buf);
+  return s;
+}
+
+// uv:arena ( h -- ): strings made in h's callbacks come from an arena freed
+// when h closes. On a listener, every client it accepts gets one.
+static void prim_uv_arena(Context *ctx) {
+  pop_handle(ctx, HND_TCP)->use_arena = true;
+}
+
+// uv:read-buffer ( h bytes -- ): read h in buffers of this size; 0 restores
+// the adaptive default. Clients accepted from a listener inherit it.
+static void prim_uv_read_buffer(Context *ctx) {
+  int64_t size = pop_int(ctx);
+  Handle *h = pop_handle(ctx, HND_TCP);
+  if (size < 0 || size > READ_BUF_MAX * 16)
+    fail(ctx, SF_ERR_TYPE, "uv:read-buffer: size out of range");
+  h->rbuf_fixed = size > 0;
+  h->rbuf = (uint32_t)size;
+  h->rbuf_small = 0;
+}
+
+// The peer hung up: pass on "" and free its slot under uv:listen-limit.
+static void stream_eof(Handle *h) {
+  if (h->batch && (h->batch->on || h->batch->queued))
+    batch_add(h, NULL, 0); // after the data still waiting
+  else
+    stream_deliver(h, read_alloc(h, 0));
+  stream_ended(h);
+}
+
+// When data arrives (or EOF), translate it into stack values and run the quote.
+static void on_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+  Handle *h = (Handle *)stream->data;
+  bool batched = h->batch && h->batch->on;
+  char *s = buf->base; // from on_read_alloc, or NULL
+  if (nread > 0)
+    read_buf_adapt(h, (size_t)nread);
+  if (nread > 0 && batched) {
+    batch_add(h, s, (size_t)nread);
+  } else if (nread > 0) {
+    stream_deliver(h, read_string(h, s, (size_t)nread, buf->len));
+    s = NULL;
+  } else if (nread == UV_EOF) {
+    uv_read_stop(stream);
+    stream_eof(h);
+  } else if (nread < 0) { /* error */
+  }
+  str_free(h->ctx, s);
+}
+
+static bool uring_read_start(Context *ctx, Handle *h);
+static bool uring_listen(Context *ctx, Handle *h, int backlog);
+static void uring_write(Context *ctx, Handle *h, char *s);
+
+static void prim_uv_read_start(Context *ctx) {
+  Quote *q = pop_quote(ctx);
+  Handle *h = pop_handle(ctx, HND_TCP);
+  if (h->cb1)
+    quote_release(h->cb1);
+  h->cb1 = q;
+  if (ctx->sim) {
+    sim_read_start(ctx, h);
+    return;
+  }
+  if (h->io && uring_read_start(ctx, h))
+    return;
+  int rc = uv_read_start((uv_stream_t *)&h->u.tcp, on_read_alloc, on_read);
+  if (rc)
+    fail(ctx, SF_ERR_UV, "uv_read_start: %s", uv_strerror(rc));
+}
+
+// Accept the connection libuv is holding and run the server's quotation
+// with the client handle, or close it straight away when refused.
+static void accept_next(Handle *hs, bool refuse) {
+  Handle *hc = handle_new(hs->ctx, HND_TCP);
+  uv_tcp_init(hs->ctx->loop, &hc->u.tcp);
+  hc->u.tcp.data = hc;
+  hc->rbuf = hs->rbuf_fixed ? hs->rbuf : 0;
+  hc->rbuf_fixed = hs->rbuf_fixed;
+  if (uv_accept(&hs->u.stream, &hc->u.stream) != 0 || refuse) {
+    uv_close(&hc->u.base, on_close_free);
+    return;
+  }
+  admitted(hs, hc);
+  accept_deliver(hs, hc);
+}
+
+static void on_connection(uv_stream_t *server, int status) {
+  Handle *hs = (Handle *)server->data;
+  if (status < 0 || !hs->ctx)
+    return;
+  AdmitDecision d = admit(hs);
+  if (d == WAIT)
+    hs->adm->pending = true; // not accepting pauses the listener
+  else
+    accept_next(hs, d == REFUSE);
+}
+
+static void prim_uv_listen(Context *ctx) {
+  Quote *q = pop_quote(ctx);
+  int64_t backlog = pop_int(ctx);
+  Handle *h = pop_handle(ctx, HND_TCP);
+  if (h->cb1)
+    quote_release(h->cb1);
+  h->cb1 = q;
+  h->listening = true;
+  if (ctx->sim) {
+    sim_listen(ctx, h);
+    return;
+  }
+  if (uring_listen(ctx, h, (int)backlog))
+    return;
+  int rc = uv_listen((uv_stream_t *)&h->u.tcp, (int)backlog, on_connection);
+  if (rc)
+    fail(ctx, SF_ERR_UV, "uv_listen: %s", uv_strerror(rc));
+}
+
+typedef struct {
+  uv_connect_t req;
+  Handle *h;
+} ConnectReq;
+
+// Outbound connect finished: on success, run the stored quotation.
+static void on_connect(uv_connect_t *req, int status) {
+  ConnectReq *cr = (ConnectReq *)req;
+  Handle *h = cr->h;
+  if (status == 0) {
+    connect_deliver(h);
+  } else { /* ignore for now */
+  }
+  free(cr);
+}
+
+static void prim_uv_tcp_connect(Context *ctx) {
+  Quote *q = pop_quote(ctx);
+  int64_t port = pop_int(ctx);
+  char *ip = pop_str_take(ctx);
+  Handle *h = pop_handle(ctx, HND_TCP);
+  if (h->cb1)
+    quote_release(h->cb1);
+  h->cb1 = q;
+  struct sockaddr_in dest;
+  uv_ip4_addr(ip, (int)port, &dest);
+  str_free(ctx, ip);
+  if (ctx->sim) {
+    sim_connect(ctx, h, &dest);
+    return;
+  }
+  ConnectReq *cr = (ConnectReq *)xcalloc(1, sizeof(ConnectReq));
+  cr->h = h;
+  int rc = uv_tcp_connect(&cr->req, &h->u.tcp, (const struct sockaddr *)&dest,
+                          on_connect);
+  if (rc) {
+    free(cr);
+    fail(ctx, SF_ERR_UV, "uv_tcp_connect: %s", uv_strerror(rc));
+  }
+}
+
+static void prim_uv_write(Context *ctx) {
+  char *s = pop_str_take(ctx);
+  Handle *h = pop_handle(ctx, HND_TCP);
+  // The write may finish after the event (and the arena) it came from.
+  s = str_escape(ctx, s, h->arena);
+  if (ctx->sim) {
+    sim_write(ctx, h, s);
+    str_free(ctx, s);
+    return;
+  }
+  if (h->io) {
+    uring_write(ctx, h, s);
+    return;
+  }
+  uv_write_t *req = (uv_write_t *)xcalloc(1, sizeof(uv_write_t));
+  uv_buf_t buf = uv_buf_init(s, (unsigned int)strlen(s));
+  req->data = s;
+  mem_charge(ctx, sizeof(uv_write_t));
+  int rc = uv_write(req, (uv_stream_t *)&h->u.tcp, &buf, 1, on_write);
+  if (rc) {
+    mem_release(ctx, sizeof(uv_write_t));
+    free(req);
+    str_free(ctx, s);
+    fail(ctx, SF_ERR_UV, "uv_write: %s", uv_strerror(rc));
+  }
+}
+
+// ---------------- io_uring backend ----------------
+// With sf_use_io_uring (`solarforth --io-uring`), TCP listeners and the
+// connections they accept run on an io_uring instead of libuv's epoll
+// path. Each listener keeps one multishot accept armed, and each reading
+// connection one multishot recv. Receives land in a ring of buffers the
+// kernel picks from. Writes queued during a turn of the loop go out as one
+// sendmsg per connection, and every operation queued in that turn is
+// submitted with a single io_uring_enter just before libuv polls; what
+// completes inline is taken right then. libuv polls the ring's own
+// descriptor, readable while completions wait, so a wakeup costs no extra
+// read, and timers, signals and the rest stay on libuv. The words behave the
+// same. Setting up needs Linux 6.0 or later; without it the context stays
+// on libuv, and a multishot operation the kernel refuses puts that socket
+// back on libuv too. uv:tcp-connect streams always use libuv, and a
+// "pause" listen limit holds accepted connections rather than leaving them
+// in the backlog.
+
+#ifdef SF_URING
+
+#define URING_ENTRIES 256
+#define URING_BUFS 128 // provided receive buffers, a power of two
+#define URING_BUF_SIZE 8192
+#define URING_IOV 32 // queued writes gathered into one sendmsg
+#define URING_RETRY_MS 100 // before accepting again after, e.g., EMFILE
+
+typedef enum { URING_ACCEPT, URING_RECV, URING_SEND } UringKind;
+
+typedef struct UringOp {
+  UringKind kind;
+  Handle *h; // NULL once the handle has closed
+  int n;     // URING_SEND: strings being sent
+  char *strs[URING_IOV];
+  struct iovec iov[URING_IOV];
+  struct msghdr msg;
+  struct UringOp *next; // on Uring.retrying
+} UringOp;
+
+// A listener's or connection's operations.
+struct UringConn {
+  UringOp *arm;  // the multishot accept or recv, while armed
+  UringOp *send; // the sendmsg in flight: one at a time keeps them in order
+  char **q;      // writes waiting for it
+  int nq, capq;
+  size_t off;  // bytes of q[0] already sent
+  bool full;   // the last send found no room: wait for some before the next
+  int backlog; // a listener's, for uv_listen if multishot accept is refused
+};
+
+struct Uring {
+  Context *ctx;
+  int fd;
+  unsigned sq_entries, sq_mask, cq_mask;
+  unsigned sq_tail; // ours, published on submit
+  _Atomic unsigned *sq_head, *sq_ktail, *cq_head, *cq_tail;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *rings;
+  size_t rings_len, sqes_len;
+  struct io_uring_buf_ring *br; // receive buffers handed to the kernel
+  char *bufs;
+  uint16_t br_tail;
+  int inflight; // operations still to complete
+  bool no_multishot_accept, no_multishot_recv;
+  uv_poll_t *poll;     // on fd, readable while completions wait
+  uv_prepare_t *flush; // submits what this turn queued
+  uv_timer_t *retry;   // re-arms the accepts waiting on retrying
+  UringOp *retrying;
+};
+
+static int uring_register(Uring *u, unsigned op, void *arg, unsigned n) {
+  return (int)syscall(__NR_io_uring_register, u->fd, op, arg, n);
+}
+
+static void uring_submit(Uring *u) {
+  atomic_store_explicit(u->sq_ktail, u->sq_tail, memory_order_release);
+  unsigned n = u->sq_tail - atomic_load_explicit(u->sq_head,
+                                                 memory_order_acquire);
+  while (n > 0) {
+    int rc = (int)syscall(__NR_io_uring_enter, u->fd, n, 0, 0, NULL, 0);
+    if (rc < 0 && errno == EINTR)
+      continue;
+    if (rc <= 0)
+      break; // left in the ring for the next turn
+    n -= (unsigned)rc;
+  }
+}
+
+static void uring_reap(Uring *u);
+
+static bool uring_unsubmitted(Uring *u) {
+  return u->sq_tail != atomic_load_explicit(u->sq_ktail, memory_order_relaxed);
+}
+
+// Submit, and take what completed inline (most sends) before libuv polls.
+// Batched reads reaped here would wait for the check phase, after a poll
+// that may block, so they are delivered now; what their quotes queue goes
+// out in the same turn.
+static void on_uring_flush(uv_prepare_t *p) {
+  Uring *u = (Uring *)p->data;
+  Context *ctx = u->ctx;
+  do {
+    while (uring_unsubmitted(u)) {
+      uring_submit(u);
+      uring_reap(u);
+    }
+    if (ctx->batch_pending)
+      on_batch_check(ctx->batch_check);
+  } while (uring_unsubmitted(u));
+  uv_prepare_stop(p);
+}
+
+// The next free submission entry, cleared; it goes out this turn.
+static struct io_uring_sqe *uring_sqe(Uring *u) {
+  if (u->sq_tail - atomic_load_explicit(u->sq_head, memory_order_acquire) >=
+      u->sq_entries)
+    uring_submit(u);
+  unsigned i = u->sq_tail & u->sq_mask;
+  struct io_uring_sqe *sqe = &u->sqes[i];
+  memset(sqe, 0, sizeof(*sqe));
+  u->sq_array[i] = i;
+  u->sq_tail++;
+  uv_prepare_start(u->flush, on_uring_flush);
+  return sqe;
+}
+
+// Operations in flight keep the loop running, as active handles would.
+static void uring_ref(Uring *u) {
+  if (u->inflight > 0)
+    uv_ref((uv_handle_t *)u->poll);
+  else
+    uv_unref((uv_handle_t *)u->poll);
+}
+
+static UringOp *uring_op_new(Uring *u, UringKind kind, Handle *h) {
+  UringOp *op = (UringOp *)xcalloc(1, sizeof(UringOp));
+  op->kind = kind;
+  op->h = h;
+  u->inflight++;
+  uring_ref(u);
+  return op;
+}
+
+static void uring_op_done(Uring *u, UringOp *op) {
+  for (int i = 0; i < op->n; i++)
+    str_free(u->ctx, op->strs[i]);
+  free(op);
+  u->inflight--;
+  uring_ref(u);
+}
+
+static int uring_fd(Handle *h) {
+  uv_os_fd_t fd;
+  return uv_fileno(&h->u.base, &fd) == 0 ? (int)fd : -1;
+}
+
+static void uring_accept_submit(Uring *u, UringOp *op) {
+  struct io_uring_sqe *sqe = uring_sqe(u);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = uring_fd(op->h);
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = (uint64_t)(uintptr_t)op;
+}
+
+static void uring_recv_submit(Uring *u, UringOp *op) {
+  struct io_uring_sqe *sqe = uring_sqe(u);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = uring_fd(op->h);
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = 0;
+  sqe->user_data = (uint64_t)(uintptr_t)op;
+}
+
+// Send as much of h's queue as one sendmsg takes.
+static void uring_send_next(Uring *u, Handle *h) {
+  UringConn *io = h->io;
+  UringOp *op = uring_op_new(u, URING_SEND, h);
+  int n = io->nq < URING_IOV ? io->nq : URING_IOV;
+  for (int i = 0; i < n; i++) {
+    size_t skip = i == 0 ? io->off : 0;
+    op->strs[i] = io->q[i];
+    op->iov[i].iov_base = io->q[i] + skip;
+    op->iov[i].iov_len = strlen(io->q[i]) - skip;
+  }
+  op->n = n;
+  io->nq -= n;
+  memmove(io->q, io->q + n, (size_t)io->nq * sizeof(char *));
+  io->off = 0;
+  op->msg.msg_iov = op->iov;
+  op->msg.msg_iovlen = (size_t)n;
+  io->send = op;
+  struct io_uring_sqe *sqe = uring_sqe(u);
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = uring_fd(h);
+  sqe->addr = (uint64_t)(uintptr_t)&op->msg;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  if (io->full)
+    sqe->ioprio = IORING_RECVSEND_POLL_FIRST;
+  io->full = false;
+  sqe->user_data = (uint64_t)(uintptr_t)op;
+}
+
+static void uring_queue(UringConn *io, int at, char *s) {
+  if (io->nq >= io->capq) {
+    io->capq = io->capq ? io->capq * 2 : 16;
+    io->q = (char **)realloc(io->q, (size_t)io->capq * sizeof(char *));
+    if (!io->q)
+      oom();
+  }
+  memmove(io->q + at + 1, io->q + at, (size_t)(io->nq - at) * sizeof(char *));
+  io->q[at] = s;
+  io->nq++;
+}
+
+static void uring_write(Context *ctx, Handle *h, char *s) {
+  if (!*s) {
+    str_free(ctx, s);
+    return;
+  }
+  uring_queue(h->io, h->io->nq, s);
+  if (!h->io->send)
+    uring_send_next(ctx->uring, h);
+}
+
+// A sendmsg finished: requeue what the kernel did not take, then go on.
+// EAGAIN and EINTR took nothing but leave the connection usable.
+static void uring_sent(Uring *u, UringOp *op, int res) {
+  Handle *h = op->h;
+  if (!h) {
+    uring_op_done(u, op);
+    return;
+  }
+  UringConn *io = h->io;
+  io->send = NULL;
+  if (res > 0 || res == -EAGAIN || res == -EINTR) {
+    size_t left = res > 0 ? (size_t)res : 0;
+    int i = 0;
+    for (; i < op->n && left >= op->iov[i].iov_len; i++) {
+      left -= op->iov[i].iov_len;
+      str_free(u->ctx, op->strs[i]);
+    }
+    for (int j = op->n - 1; j >= i; j--)
+      uring_queue(io, 0, op->strs[j]);
+    if (i < op->n)
+      io->off = (size_t)((char *)op->iov[i].iov_base - op->strs[i]) + left;
+    op->n = 0;
+    io->full = res == -EAGAIN;
+  } else { // the peer is gone: drop what is queued, as libuv would fail it
+    while (io->nq > 0)
+      str_free(u->ctx, io->q[--io->nq]);
+  }
+  uring_op_done(u, op);
+  if (io->nq)
+    uring_send_next(u, h);
+}
+
+// Accept errors that clear by themselves. Others, like running out of
+// descriptors, would fail again as soon as the accept is submitted.
+static bool uring_accept_transient(int res) {
+  return res >= 0 || res == -ECANCELED || res == -ECONNABORTED ||
+         res == -EINTR || res == -EAGAIN;
+}
+
+static void on_uring_retry(uv_timer_t *t) {
+  Uring *u = (Uring *)t->data;
+  UringOp *op = u->retrying;
+  u->retrying = NULL;
+  while (op) {
+    UringOp *next = op->next;
+    op->next = NULL;
+    if (op->h && !uv_is_closing(&op->h->u.base))
+      uring_accept_submit(u, op);
+    else
+      uring_op_done(u, op);
+    op = next;
+  }
+}
+
+static void uring_accepted(Uring *u, UringOp *op, int res, bool more) {
+  Handle *hs = op->h;
+  if (res >= 0 && !hs) {
+    close(res);
+  } else if (res >= 0) {
+    Context *ctx = hs->ctx;
+    Handle *hc = handle_new(ctx, HND_TCP);
+    uv_tcp_init(ctx->loop, &hc->u.tcp);
+    hc->u.tcp.data = hc;
+    hc->rbuf = hs->rbuf_fixed ? hs->rbuf : 0;
+    hc->rbuf_fixed = hs->rbuf_fixed;
+    if (uv_tcp_open(&hc->u.tcp, res) != 0) {
+      close(res);
+      uv_close(&hc->u.base, on_close_free);
+    } else {
+      hc->io = (UringConn *)xcalloc(1, sizeof(UringConn));
+      admit_accepted(ctx, hs, hc);
+    }
+  } else if (res == -EINVAL && hs) { // no multishot accept: use libuv
+    u->no_multishot_accept = true;
+    hs->io->arm = NULL;
+    uring_op_done(u, op);
+    int rc = uv_listen(&hs->u.stream, hs->io->backlog, on_connection);
+    if (rc) {
+      Context *ctx = hs->ctx;
+      ctx->err = SF_ERR_UV;
+      snprintf(ctx->errmsg, sizeof(ctx->errmsg), "uv_listen: %s",
+               uv_strerror(rc));
+      callback_failed(ctx);
+    }
+    return;
+  }
+  if (more)
+    return;
+  hs = op->h;
+  if (!hs || uv_is_closing(&hs->u.base)) {
+    if (hs)
+      hs->io->arm = NULL;
+    uring_op_done(u, op);
+  } else if (uring_accept_transient(res)) {
+    uring_accept_submit(u, op);
+  } else { // the connection stays queued: try again later, as libuv does
+    op->next = u->retrying;
+    u->retrying = op;
+    if (!uv_is_active((uv_handle_t *)u->retry))
+      uv_timer_start(u->retry, on_uring_retry, URING_RETRY_MS, 0);
+  }
+}
+
+// Hand a receive buffer back to the kernel.
+static void uring_buf_recycle(Uring *u, unsigned bid) {
+  struct io_uring_buf *b = &u->br->bufs[u->br_tail & (URING_BUFS - 1)];
+  b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * URING_BUF_SIZE);
+  b->len = URING_BUF_SIZE;
+  b->bid = (uint16_t)bid;
+  u->br_tail++;
+  atomic_store_explicit((_Atomic uint16_t *)&u->br->tail, u->br_tail,
+                        memory_order_release);
+}
+
+static void uring_received(Uring *u, UringOp *op,
+                           const struct io_uring_cqe *c) {
+  Handle *h = op->h;
+  bool more = c->flags & IORING_CQE_F_MORE;
+  char *s = NULL;
+  if (c->flags & IORING_CQE_F_BUFFER) {
+    unsigned bid = c->flags >> IORING_CQE_BUFFER_SHIFT;
+    const char *data = u->bufs + (size_t)bid * URING_BUF_SIZE;
+    if (h && c->res > 0 && h->batch && h->batch->on) {
+      batch_add(h, data, (size_t)c->res);
+    } else if (h && c->res > 0) {
+      s = read_alloc(h, (size_t)c->res);
+      memcpy(s, data, (size_t)c->res);
+    }
+    uring_buf_recycle(u, bid);
+  }
+  if (s) {
+    stream_deliver(h, s);
+  } else if (h && c->res == 0) {
+    stream_eof(h);
+  } else if (h && c->res == -EINVAL) { // no multishot recv: use libuv
+    u->no_multishot_recv = true;
+    h->io->arm = NULL;
+    uring_op_done(u, op);
+    uv_read_start(&h->u.stream, on_read_alloc, on_read);
+    return;
+  }
+  if (more)
+    return;
+  // Out of buffers, or the kernel ended it early: arm it again. EOF,
+  // errors and closing end it.
+  h = op->h;
+  if (h && !uv_is_closing(&h->u.base) && (c->res > 0 || c->res == -ENOBUFS)) {
+    uring_recv_submit(u, op);
+  } else {
+    if (h)
+      h->io->arm = NULL;
+    uring_op_done(u, op);
+  }
+}
+
+static void uring_reap(Uring *u) {
+  for (;;) {
+    unsigned head = atomic_load_explicit(u->cq_head, memory_order_relaxed);
+    if (head == atomic_load_explicit(u->cq_tail, memory_order_acquire))
+      return;
+    struct io_uring_cqe c = u->cqes[head & u->cq_mask];
+    atomic_store_explicit(u->cq_head, head + 1, memory_order_release);
+    UringOp *op = (UringOp *)(uintptr_t)c.user_data;
+    if (op->kind == URING_ACCEPT)
+      uring_accepted(u, op, c.res, c.flags & IORING_CQE_F_MORE);
+    else if (op->kind == URING_RECV)
+      uring_received(u, op, &c);
+    else
+      uring_sent(u, op, c.res);
+  }
+}
+
+static void on_uring_event(uv_poll_t *p, int status, int events) {
+  (void)status;
+  (void)events;
+  Uring *u = (Uring *)p->data;
+  uring_reap(u);
+}
+
+// Cancel every operation on h's socket, which must still be open, and wait
+// for them, so nothing the kernel does later refers to h.
+static void uring_detach(Context *ctx, Handle *h) {
+  UringConn *io = h->io;
+  Uring *u = ctx->uring;
+  h->io = NULL;
+  if (io->arm)
+    io->arm->h = NULL;
+  if (io->send)
+    io->send->h = NULL;
+  int fd = uring_fd(h);
+  if ((io->arm || io->send) && fd >= 0) {
+    struct io_uring_sync_cancel_reg reg = {
+        .fd = fd,
+        .flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL,
+        .timeout = {.tv_sec = -1, .tv_nsec = -1}};
+    uring_submit(u); // the kernel has to have seen them
+    uring_register(u, IORING_REGISTER_SYNC_CANCEL, &reg, 1);
+  }
+  while (io->nq > 0)
+    str_free(ctx, io->q[--io->nq]);
+  free(io->q);
+  free(io);
+}
+
+static bool uring_listen(Context *ctx, Handle *h, int backlog) {
+  Uring *u = ctx->uring;
+  int fd = uring_fd(h);
+  if (!u || u->no_multishot_accept || fd < 0)
+    return false;
+  if (listen(fd, backlog) != 0)
+    fail(ctx, SF_ERR_UV, "listen: %s", strerror(errno));
+  h->io = (UringConn *)xcalloc(1, sizeof(UringConn));
+  h->io->backlog = backlog;
+  h->io->arm = uring_op_new(u, URING_ACCEPT, h);
+  uring_accept_submit(u, h->io->arm);
+  return true;
+}
+
+static bool uring_read_start(Context *ctx, Handle *h) {
+  Uring *u = ctx->uring;
+  if (u->no_multishot_recv)
+    return false;
+  if (!h->io->arm) {
+    h->io->arm = uring_op_new(u, URING_RECV, h);
+    uring_recv_submit(u, h->io->arm);
+  }
+  return true;
+}
+
+// Close the descriptors and unmap; the loop handles are closed separately.
+static void uring_unmap(Uring *u) {
+  if (u->fd >= 0)
+    close(u->fd);
+  if (u->rings)
+    munmap(u->rings, u->rings_len);
+  if (u->sqes)
+    munmap(u->sqes, u->sqes_len);
+  if (u->br)
+    munmap(u->br, URING_BUFS * sizeof(struct io_uring_buf));
+  free(u->bufs);
+  free(u);
+}
+
+static void uring_free(Context *ctx) {
+  Uring *u = ctx->uring;
+  if (!u)
+    return;
+  struct io_uring_sync_cancel_reg reg = {
+      .fd = -1,
+      .flags = IORING_ASYNC_CANCEL_ANY,
+      .timeout = {.tv_sec = -1, .tv_nsec = -1}};
+  uring_submit(u);
+  uring_register(u, IORING_REGISTER_SYNC_CANCEL, &reg, 1);
+  uring_reap(u); // every handle is detached: this only frees operations
+  while (u->retrying) {
+    UringOp *op = u->retrying;
+    u->retrying = op->next;
+    uring_op_done(u, op);
+  }
+  ctx->uring = NULL;
+  mem_release(ctx, URING_BUFS * URING_BUF_SIZE);
+  uv_close((uv_handle_t *)u->poll, free_on_close);
+  uv_close((uv_handle_t *)u->flush, free_on_close);
+  uv_close((uv_handle_t *)u->retry, free_on_close);
+  uring_unmap(u);
+}
+
+static const char *uring_map(Uring *u, const struct io_uring_params *p) {
+  size_t sq_len = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+  size_t cq_len = p->cq_off.cqes + p->cq_entries * sizeof(*u->cqes);
+  u->rings_len = sq_len > cq_len ? sq_len : cq_len;
+  void *rings = mmap(NULL, u->rings_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (rings == MAP_FAILED)
+    return strerror(errno);
+  u->rings = rings;
+  u->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    return strerror(errno);
+  u->sqes = (struct io_uring_sqe *)sqes;
+  char *r = (char *)rings;
+  u->sq_head = (_Atomic unsigned *)(r + p->sq_off.head);
+  u->sq_ktail = (_Atomic unsigned *)(r + p->sq_off.tail);
+  u->sq_mask = *(unsigned *)(r + p->sq_off.ring_mask);
+  u->sq_entries = p->sq_entries;
+  u->sq_array = (unsigned *)(r + p->sq_off.array);
+  u->sq_tail = *(unsigned *)u->sq_ktail;
+  u->cq_head = (_Atomic unsigned *)(r + p->cq_off.head);
+  u->cq_tail = (_Atomic unsigned *)(r + p->cq_off.tail);
+  u->cq_mask = *(unsigned *)(r + p->cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(r + p->cq_off.cqes);
+  return NULL;
+}
+
+// Give the kernel its receive buffers (buffer group 0).
+static const char *uring_buffers(Uring *u) {
+  void *br = mmap(NULL, URING_BUFS * sizeof(struct io_uring_buf),
+                  PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (br == MAP_FAILED)
+    return strerror(errno);
+  u->br = (struct io_uring_buf_ring *)br;
+  u->bufs = (char *)xmalloc((size_t)URING_BUFS * URING_BUF_SIZE);
+  struct io_uring_buf_reg reg = {.ring_addr = (uint64_t)(uintptr_t)br,
+                                 .ring_entries = URING_BUFS,
+                                 .bgid = 0};
+  if (uring_register(u, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    return "no provided buffer rings (needs Linux 6.0)";
+  for (unsigned i = 0; i < URING_BUFS; i++)
+    uring_buf_recycle(u, i);
+  return NULL;
+}
+
+static const char *uring_open(Context *ctx) {
+  if (ctx->uring)
+    return NULL;
+  if (ctx->sim)
+    return "not available in simulation";
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CLAMP;
+  int fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+  if (fd < 0)
+    return strerror(errno);
+  Uring *u = (Uring *)xcalloc(1, sizeof(Uring));
+  u->ctx = ctx;
+  u->fd = fd;
+  const char *why = NULL;
+  struct io_uring_sync_cancel_reg none = {
+      .fd = -1,
+      .flags = IORING_ASYNC_CANCEL_ANY,
+      .timeout = {.tv_sec = -1, .tv_nsec = -1}};
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(p.features & IORING_FEAT_NODROP))
+    why = "kernel too old";
+  else
+    why = uring_map(u, &p);
+  // Synchronous cancellation came with multishot receives in Linux 6.0.
+  if (!why && uring_register(u, IORING_REGISTER_SYNC_CANCEL, &none, 1) < 0 &&
+      errno != ENOENT)
+    why = "no multishot receives (needs Linux 6.0)";
+  if (!why)
+    why = uring_buffers(u);
+  if (why) {
+    uring_unmap(u);
+    return why;
+  }
+  u->poll = (uv_poll_t *)xmalloc(sizeof(uv_poll_t));
+  uv_poll_init(ctx->loop, u->poll, u->fd);
+  u->poll->data = u;
+  uv_poll_start(u->poll, UV_READABLE, on_uring_event);
+  u->flush = (uv_prepare_t *)xmalloc(sizeof(uv_prepare_t));
+  uv_prepare_init(ctx->loop, u->flush);
+  u->flush->data = u;
+  uv_unref((uv_handle_t *)u->flush);
+  u->retry = (uv_timer_t *)xmalloc(sizeof(uv_timer_t));
+  uv_timer_init(ctx->loop, u->retry);
+  u->retry->data = u;
+  uv_unref((uv_handle_t *)u->retry);
+  uring_ref(u);
+  mem_charge(ctx, URING_BUFS * URING_BUF_SIZE);
+  ctx->uring = u;
+  return NULL;
+}
+
+#else // !SF_URING
+
+static void uring_write(Context *ctx, Handle *h, char *s) {
+  (void)ctx;
+  (void)h;
+  (void)s;
+}
+static void uring_detach(Context *ctx, Handle *h) {
+  (void)ctx;
+  (void)h;
+}
+static bool uring_listen(Context *ctx, Handle *h, int backlog) {
+  (void)ctx;
+  (void)h;
+  (void)backlog;
+  return false;
+}
+static bool uring_read_start(Context *ctx, Handle *h) {
+  (void)ctx;
+  (void)h;
+  return false;
+}
+static void uring_free(Context *ctx) { (void)ctx; }
+static const char *uring_open(Context *ctx) {
+  (void)ctx;
+  return "not supported on this system";
+}
+
+#endif // SF_URING
+
+// The table handed to native modules; see SfNativeApi in solarforth.h.
+static const SfNativeApi native_api = {
+    .abi = SF_NATIVE_ABI,
+    .size = sizeof(SfNativeApi),
+    .register_prim = sf_register_prim,
+    .depth = sf_depth,
+    .push_int = sf_push_int,
+    .push_str = sf_push_str,
+    .pop_int = sf_pop_int,
+    .pop_str = sf_pop_str,
+    .fail = sf_fail,
+    .loop = sf_context_loop,
+};
+
+// Load a shared object and let it register its words with this context.
+static void prim_load_native(Context *ctx) {
+  char *path = pop_str_take(ctx);
+  char msg[200];
+  void *lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (!lib) {
+    snprintf(msg, sizeof(msg), "%s", dlerror());
+    str_free(ctx, path);
+    fail(ctx, SF_ERR_NATIVE, "load-native: %s", msg);
+  }
+  SfNativeInitFn init;
+  *(void **)&init = dlsym(lib, SF_NATIVE_INIT);
+  if (!init) {
+    snprintf(msg, sizeof(msg), "%s: no %s", path, SF_NATIVE_INIT);
+    str_free(ctx, path);
+    dlclose(lib);
+    fail(ctx, SF_ERR_NATIVE, "load-native: %s", msg);
+  }
+  str_free(ctx, path);
+  int rc = init(ctx, &native_api);
+  if (rc != SF_OK)
+    fail(ctx, SF_ERR_NATIVE, "load-native: init failed (%d)", rc);
+}
+
+// Start a definition at tokens[*i] (the ":"), consuming its name.
+static void begin_definition(Context *ctx, CompileState *cs, char **tokens,
+                             int count, int *i) {
+  if (*i + 1 >= count) {
+    fail(ctx, SF_ERR_SYNTAX, "expected name after :");
+  }
+  (*i)++;
+  strncpy(cs->name, tokens[*i], sizeof(cs->name) - 1);
+  cs->name[sizeof(cs->name) - 1] = '\0';
+  cs->curr = quote_new();
+  cs->compiling = true;
+}
+
+// Add tokens[*i] to the definition being compiled. Returns true at the
+// closing ";", leaving the finished body in cs->curr.
+static bool compile_token(Context *ctx, CompileState *cs, char **tokens,
+                          int count, int *i) {
+  char *t = tokens[*i];
+  if (strcmp(t, ";") == 0) {
+    cs->compiling = false;
+    return true;
+  }
+  if (strcmp(t, "[") == 0) {
+    Quote *qq = quote_new();
+    int depth = 1;
+    int j = *i + 1;
+    while (j < count) {
+      if (strcmp(tokens[j], "[") == 0)
+        depth++;
+      else if (strcmp(tokens[j], "]") == 0) {
+        depth--;
+        if (depth == 0)
+          break;
+      }
+      quote_add_token(qq, tokens[j]);
+      j++;
+    }
+    if (depth != 0) {
+      quote_release(qq);
+      fail(ctx, SF_ERR_SYNTAX, "unclosed quote in definition");
+    }
+    *i = j;
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "#Q:%p", (void *)qq);
+    quote_add_token(cs->curr, buf);
+    return false;
+  }
+  quote_add_token(cs->curr, t);
+  return false;
+}
+
+static void exec_tokens(Context *ctx, char **tokens, int count) {
+  CompileState cs = {0};
+  for (int i = 0; i < count; i++) {
+    char *t = tokens[i];
+    if (ctx->limits.max_bytes || ctx->limits.max_cpu_ns)
+      check_limits(ctx);
+    if (cs.compiling) {
+      if (compile_token(ctx, &cs, tokens, count, &i)) {
+        dict_add_colon(ctx->dict, cs.name, cs.curr);
+        mem_charge(ctx, sizeof(Word) + strlen(cs.name) + 1 +
+                            quote_bytes(cs.curr));
+        cs.curr = NULL;
+      }
+      continue;
+    }
+
+    if (strcmp(t, ":") == 0) {
+      begin_definition(ctx, &cs, tokens, count, &i);
+      continue;
+    }
+    if (strcmp(t, "[") == 0) {
+      Quote *q = quote_new();
+      int depth = 1;
+      int j = i + 1;
+      for (; j < count; j++) {
+        if (strcmp(tokens[j], "[") == 0)
+          depth++;
+        else if (strcmp(tokens[j], "]") == 0) {
+          depth--;
+          if (depth == 0)
+            break;
+        }
+        quote_add_token(q, tokens[j]);
+      }
+      if (depth != 0) {
+        fail(ctx, SF_ERR_SYNTAX, "unclosed quote [ ... ]");
+      }
+      i = j;
+      push(&ctx->ds, VQuote(q));
+      continue;
+    }
+    if (strcmp(t, "]") == 0) {
+      fail(ctx, SF_ERR_SYNTAX, "unexpected ]");
+    }
+    if (is_number(t)) {
+      long long v = strtoll(t, NULL, 0);
+      push(&ctx->ds, VInt(v));
+      continue;
+    }
+
+    const Word *w = dict_lookup(ctx->dict, t);
+    if (w) {
+      exec_word(ctx, w);
+      continue;
+    }
+
+    if (strncmp(t, "#S:", 3) == 0) {
+      push(&ctx->ds, VStr(ctx, t + 3));
+      continue;
+    }
+
+    if (strncmp(t, "#Q:", 3) == 0) {
+      void *ptr = NULL;
+      sscanf(t + 3, "%p", &ptr);
+      // The definition keeps its reference; the stack (and any handle
+      // that takes it as a callback) shares the quote.
+      push(&ctx->ds, VQuote(quote_retain((Quote *)ptr)));
+      continue;
+    }
+
+    fail(ctx, SF_ERR_UNKNOWN_WORD, "unknown word: %s", t);
+  }
+}
+
+// ---------------- Hot reload ----------------
+// reload re-reads a script and compiles only its colon definitions; the
+// rest of the file (listeners, timers, uv:run) is skipped, so reloading
+// never repeats setup. The whole file compiles before anything changes: a
+// file with an error leaves every old body in place. Existing words get
+// their new body in place, and because names resolve when code runs, quotes
+// held by live handles pick it up on their next event. An old body may
+// still be running further up the C stack, so it is retired and freed once
+// the context's outermost evaluation (or callback) has unwound, or, under
+// uv:run, once a callback returns to the loop, unless a body is one of those
+// uv:run was called from.
+
+static void retire_code(Context *ctx, Quote *code) {
+  if (ctx->nretired >= ctx->retired_cap) {
+    ctx->retired_cap = ctx->retired_cap ? ctx->retired_cap * 2 : 8;
+    ctx->retired = (Quote **)realloc(ctx->retired,
+                                     ctx->retired_cap * sizeof(Quote *));
+    if (!ctx->retired)
+      oom();
+  }
+  ctx->retired[ctx->nretired++] = code;
+}
+static void retired_flush(Context *ctx) {
+  for (int i = 0; i < ctx->nretired; i++) {
+    mem_release(ctx, quote_bytes(ctx->retired[i]));
+    word_code_free(ctx->retired[i]);
+  }
+  ctx->nretired = 0;
+}
+static bool body_below_run(const Context *ctx, const Quote *code) {
+  for (int i = 0; i < ctx->run_active; i++)
+    if (ctx->active[i] == code)
+      return true;
+  return false;
+}
+// The C stack has unwound to `outer`: free what is no longer running.
+static void retired_settle(Context *ctx, jmp_buf *outer) {
+  if (!outer) {
+    retired_flush(ctx);
+    return;
+  }
+  if (outer != ctx->run_trap)
+    return;
+  int kept = 0;
+  for (int i = 0; i < ctx->nretired; i++) {
+    Quote *code = ctx->retired[i];
+    if (body_below_run(ctx, code)) {
+      ctx->retired[kept++] = code;
+    } else {
+      mem_release(ctx, quote_bytes(code));
+      word_code_free(code);
+    }
+  }
+  ctx->nretired = kept;
+}
+
+typedef struct {
+  char name[128];
+  Quote *code;
+} Def;
+
+// Compile state lives on the heap so it survives a longjmp intact.
+typedef struct {
+  TokStream ts;
+  CompileState cs;
+  Def *defs;
+  int ndefs;
+} Reload;
+
+static void reload_free(Reload *r) {
+  for (int i = 0; i < r->ndefs; i++)
+    word_code_free(r->defs[i].code);
+  if (r->cs.compiling)
+    word_code_free(r->cs.curr);
+  free(r->defs);
+  ts_free(&r->ts);
+  free(r);
+}
+
+static void reload_path(Context *ctx, const char *path) {
+  char *buf = read_file(path);
+  if (!buf)
+    fail(ctx, SF_ERR_IO, "cannot read %s", path);
+  Reload *r = (Reload *)xcalloc(1, sizeof(Reload));
+  ts_init(&r->ts);
+  scan_tokens(buf, &r->ts);
+  free(buf);
+
+  jmp_buf trap;
+  jmp_buf *outer = ctx->trap;
+  ctx->trap = &trap;
+  if (setjmp(trap) != 0) {
+    ctx->trap = outer;
+    reload_free(r);
+    rethrow(ctx);
+  }
+  int depth = 0; // skip ":" inside top-level quotes
+  for (int i = 0; i < r->ts.count; i++) {
+    char *t = r->ts.toks[i];
+    if (r->cs.compiling) {
+      if (compile_token(ctx, &r->cs, r->ts.toks, r->ts.count, &i)) {
+        r->defs = (Def *)realloc(r->defs, (r->ndefs + 1) * sizeof(Def));
+        if (!r->defs)
+          oom();
+        memcpy(r->defs[r->ndefs].name, r->cs.name, sizeof(r->cs.name));
+        r->defs[r->ndefs++].code = r->cs.curr;
+        r->cs.curr = NULL;
+      }
+    } else if (strcmp(t, "[") == 0) {
+      depth++;
+    } else if (strcmp(t, "]") == 0) {
+      depth--;
+    } else if (depth == 0 && strcmp(t, ":") == 0) {
+      begin_definition(ctx, &r->cs, r->ts.toks, r->ts.count, &i);
+    }
+  }
+  if (r->cs.compiling)
+    fail(ctx, SF_ERR_SYNTAX, "unterminated definition: %s", r->cs.name);
+  ctx->trap = outer;
+
+  for (int i = 0; i < r->ndefs; i++) {
+    Def *d = &r->defs[i];
+    Word *w = NULL;
+    for (Word *x = ctx->dict->head; x && !w; x = x->next)
+      if (strcmp(x->name, d->name) == 0)
+        w = x;
+    mem_charge(ctx, quote_bytes(d->code));
+    if (w && !w->is_prim) {
+      retire_code(ctx, w->code);
+      w->code = d->code;
+    } else {
+      dict_add_colon(ctx->dict, d->name, d->code);
+      mem_charge(ctx, sizeof(Word) + strlen(d->name) + 1);
+    }
+    d->code = NULL;
+  }
+  r->ndefs = 0;
+  reload_free(r);
+}
+
+// reload ( path -- )
+static void prim_reload(Context *ctx) {
+  char *s = pop_str_take(ctx);
+  char path[4096];
+  snprintf(path, sizeof(path), "%s", s);
+  str_free(ctx, s);
+  reload_path(ctx, path);
+}
+
+// Reload from a loop callback. Errors are reported (to the host's handler,
+// else stderr) but never stop the loop; the next save retries.
+static void reload_reporting(Context *ctx, const char *path) {
+  jmp_buf trap;
+  jmp_buf *outer = ctx->trap;
+  ctx->trap = &trap;
+  meter_enter(ctx);
+  if (setjmp(trap) == 0) {
+    reload_path(ctx, path);
+    meter_leave(ctx);
+  } else {
+    meter_leave(ctx);
+    if (ctx->on_error)
+      ctx->on_error(ctx, ctx->err, ctx->errmsg, ctx->on_error_data);
+    else
+      err_printf(ctx, "reload %s: %s\n", path, ctx->errmsg);
+  }
+  ctx->trap = outer;
+  retired_settle(ctx, outer);
+}
+
+#define WATCH_RETRY_MS 100
+
+// A watched file changed: reload it, mark its cached copy stale, or run
+// the uv:fs-event quote with ( h filename events ).
+static void watch_changed(Handle *h, const char *filename, int events) {
+  Context *ctx = h->ctx;
+  if (h->cached) {
+    h->stale = true;
+  } else if (h->cb1) {
+    push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+    push(&ctx->ds, VStr(ctx, filename ? filename : h->path));
+    push(&ctx->ds, VInt(events));
+    run_callback(ctx, h->cb1, 3);
+  } else {
+    reload_reporting(ctx, h->path);
+  }
+}
+
+static void on_watch(uv_fs_event_t *ev, const char *filename, int events,
+                     int status);
+
+// Watch again every path that was missing, and take each that is back as
+// changed. Editors that move the old file aside before writing the new one
+// leave a gap of a few milliseconds.
+static void on_watch_retry(uv_timer_t *t) {
+  Context *ctx = (Context *)t->data;
+  bool missing = false;
+  for (Handle *h = ctx->handles; h; h = h->next) {
+    if (h->type != HND_FS_EVENT || uv_is_active(&h->u.base) ||
+        uv_is_closing(&h->u.base))
+      continue;
+    if (uv_fs_event_start(&h->u.fs_event, on_watch, h->path, 0) == 0)
+      watch_changed(h, h->path, UV_CHANGE);
+    else
+      missing = true;
+  }
+  if (!missing)
+    uv_timer_stop(t);
+}
+
+static void watch_retry(Context *ctx) {
+  if (!ctx->watch_retry) {
+    ctx->watch_retry = (uv_timer_t *)xmalloc(sizeof(uv_timer_t));
+    uv_timer_init(ctx->loop, ctx->watch_retry);
+    ctx->watch_retry->data = ctx;
+    uv_unref((uv_handle_t *)ctx->watch_retry);
+  }
+  if (!uv_is_active((uv_handle_t *)ctx->watch_retry))
+    uv_timer_start(ctx->watch_retry, on_watch_retry, WATCH_RETRY_MS,
+                   WATCH_RETRY_MS);
+}
+
+static void on_watch(uv_fs_event_t *ev, const char *filename, int events,
+                     int status) {
+  Handle *h = (Handle *)ev->data;
+  if (status < 0 || !h->ctx)
+    return;
+  // Editors that save by renaming a new file over the old one leave the
+  // watch on a dead inode; follow the path instead. While nothing is there,
+  // the retry timer keeps trying, and a script is reloaded once it is back.
+  if (events & UV_RENAME) {
+    uv_fs_event_stop(ev);
+    if (uv_fs_event_start(ev, on_watch, h->path, 0) != 0) {
+      watch_retry(h->ctx);
+      if (!h->cb1 && !h->cached)
+        return;
+    }
+  }
+  watch_changed(h, filename, events);
+}
+
+static Handle *watch_path(Context *ctx, const char *path) {
+  Handle *h = handle_new(ctx, HND_FS_EVENT);
+  uv_fs_event_init(ctx->loop, &h->u.fs_event);
+  h->u.fs_event.data = h;
+  h->path = xstrdup(path);
+  int rc = uv_fs_event_start(&h->u.fs_event, on_watch, path, 0);
+  if (rc) {
+    uv_close(&h->u.base, on_close_free);
+    fail(ctx, SF_ERR_UV, "uv_fs_event_start: %s", uv_strerror(rc));
+  }
+  return h;
+}
+
+// reload:watch ( path -- h ): reload whenever the file changes.
+static void prim_reload_watch(Context *ctx) {
+  char *s = pop_str_take(ctx);
+  char path[4096];
+  snprintf(path, sizeof(path), "%s", s);
+  str_free(ctx, s);
+  Handle *h = watch_path(ctx, path);
+  push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+}
+
+// ---------------- File watching ----------------
+// uv:fs-event runs a quote when a file or directory changes. file:cache
+// keeps a file's contents in memory and reads it again only after a change
+// notification, so config and assets served on every request cost a copy
+// rather than an open and a read. Both follow a path that an editor saves
+// by renaming over it, like reload:watch.
+
+// uv:fs-event ( path q -- h ): the quote gets ( h filename events ), where
+// events is 1 for a rename, 2 for a change, 3 for both.
+static void prim_uv_fs_event(Context *ctx) {
+  Quote *q = pop_quote(ctx);
+  char path[4096];
+  jmp_buf trap;
+  jmp_buf *outer = ctx->trap;
+  ctx->trap = &trap;
+  if (setjmp(trap) != 0) {
+    ctx->trap = outer;
+    quote_release(q);
+    rethrow(ctx);
+  }
+  char *s = pop_str_take(ctx);
+  snprintf(path, sizeof(path), "%s", s);
+  str_free(ctx, s);
+  Handle *h = watch_path(ctx, path);
+  ctx->trap = outer;
+  h->cb1 = q;
+  push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+}
+
+// Read the file into the cache. A file that can't be read now (say,
+// mid-save) keeps the old contents, still stale, to retry next time.
+static void cache_load(Context *ctx, Handle *h) {
+  char *buf = read_file(h->path);
+  if (!buf)
+    return;
+  if (h->cached)
+    mem_release(ctx, strlen(h->cached) + 1);
+  free(h->cached);
+  h->cached = buf;
+  h->stale = false;
+  mem_charge(ctx, strlen(buf) + 1);
+}
+
+// file:cache ( path -- h ): read a file and keep it up to date.
+static void prim_file_cache(Context *ctx) {
+  char *s = pop_str_take(ctx);
+  char path[4096];
+  snprintf(path, sizeof(path), "%s", s);
+  str_free(ctx, s);
+  char *buf = read_file(path);
+  if (!buf)
+    fail(ctx, SF_ERR_IO, "cannot read %s", path);
+  Handle *h = watch_path(ctx, path);
+  h->cached = buf;
+  mem_charge(ctx, strlen(buf) + 1);
+  push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+}
+
+// file:cached ( h -- str ): the contents, read again first if changed.
+static void prim_file_cached(Context *ctx) {
+  Handle *h = pop_handle(ctx, HND_FS_EVENT);
+  if (!h->cached)
+    fail(ctx, SF_ERR_TYPE, "file:cached: not a file:cache handle");
+  // The path was missing when a rename restarted the watch: try again, and
+  // read it, since changes in between went unseen.
+  if (!uv_is_active(&h->u.base) && !uv_is_closing(&h->u.base) &&
+      uv_fs_event_start(&h->u.fs_event, on_watch, h->path, 0) == 0)
+    h->stale = true;
+  if (h->stale)
+    cache_load(ctx, h);
+  push(&ctx->ds, VStr(ctx, h->cached));
+}
+
+// ---------------- Logging ----------------
+// log:info and friends format one logfmt record each,
+//   ts=2026-01-02T03:04:05.678Z level=info msg="..."
+// into a ring buffer allocated on first use. The writer drains it in
+// batches: a check hook at the end of each turn of the loop hands new
+// records either to the stdout writer, or to a thread that appends them to
+// the log:file. With the thread, the ring is single-producer
+// single-consumer: the loop only moves `head` and the thread only moves
+// `tail`, so neither side takes a lock. A full ring drops the record and
+// counts it. Records below the level are rejected before any formatting.
+
+#define LOG_RING_SIZE ((size_t)1 << 20) // power of two
+#define LOG_MAX_RECORD 1024
+
+enum { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_OFF };
+static const char *const log_level_names[] = {"debug", "info", "warn",
+                                              "error", "off"};
+
+typedef struct Log {
+  char *ring;
+  _Atomic size_t head; // bytes ever written into the ring (loop thread)
+  _Atomic size_t tail; // bytes ever written out (thread, or loop for stdout)
+  size_t kicked;       // head when the thread was last woken
+  int level;           // lowest level recorded
+  uint64_t records;
+  uint64_t dropped;
+  uv_check_t check;
+  uv_file fd; // log:file, or -1 for stdout
+  char *path; // of the log:file, for reopening
+  uv_thread_t thread;
+  uv_sem_t wake;
+  atomic_bool stop;
+  int64_t stamp_sec; // the cached "YYYY-MM-DDTHH:MM:SS" is for this second
+  char stamp[24];
+} Log;
+
+// Write everything between tail and head to fd (or the stdout writer).
+static void log_drain(Log *lg, StdioWriter *out) {
+  size_t head = atomic_load_explicit(&lg->head, memory_order_acquire);
+  size_t tail = atomic_load_explicit(&lg->tail, memory_order_relaxed);
+  while (tail < head) {
+    size_t off = tail & (LOG_RING_SIZE - 1);
+    size_t n = head - tail;
+    if (n > LOG_RING_SIZE - off)
+      n = LOG_RING_SIZE - off;
+    if (out) {
+      writer_put(out, lg->ring + off, n);
+    } else {
+      ssize_t w = write(lg->fd, lg->ring + off, n);
+      if (w < 0 && errno == EINTR)
+        continue;
+      if (w > 0)
+        n = (size_t)w;
+      // On a write error the batch is lost; the ring must keep moving.
+    }
+    tail += n;
+    atomic_store_explicit(&lg->tail, tail, memory_order_release);
+  }
+}
+
+static void log_thread(void *arg) {
+  Log *lg = (Log *)arg;
+  for (;;) {
+    uv_sem_wait(&lg->wake);
+    log_drain(lg, NULL);
+    if (atomic_load(&lg->stop))
+      return;
+  }
+}
+
+// Hand what was logged since the last call to the writer.
+static void log_flush(Context *ctx) {
+  Log *lg = ctx->log;
+  if (!lg)
+    return;
+  if (lg->fd < 0) {
+    log_drain(lg, ctx_stdio(ctx, 1));
+    writer_schedule(ctx->stdout_w);
+    return;
+  }
+  size_t head = atomic_load_explicit(&lg->head, memory_order_relaxed);
+  if (head != lg->kicked) {
+    lg->kicked = head;
+    uv_sem_post(&lg->wake);
+  }
+}
+
+static void on_log_check(uv_check_t *check) {
+  log_flush((Context *)check->data);
+}
+
+static Log *log_get(Context *ctx) {
+  if (ctx->log)
+    return ctx->log;
+  Log *lg = (Log *)xcalloc(1, sizeof(Log));
+  lg->ring = (char *)xmalloc(LOG_RING_SIZE);
+  lg->level = LOG_INFO;
+  lg->fd = -1;
+  lg->stamp_sec = -1;
+  uv_check_init(ctx->loop, &lg->check);
+  lg->check.data = ctx;
+  uv_check_start(&lg->check, on_log_check);
+  uv_unref((uv_handle_t *)&lg->check);
+  mem_charge(ctx, sizeof(Log) + LOG_RING_SIZE);
+  ctx->log = lg;
+  return lg;
+}
+
+// Stop the file thread once it has written everything, and close the file.
+static void log_close_file(Log *lg) {
+  if (lg->fd < 0)
+    return;
+  atomic_store(&lg->stop, true);
+  uv_sem_post(&lg->wake);
+  uv_thread_join(&lg->thread);
+  uv_sem_destroy(&lg->wake);
+  uv_fs_t req;
+  uv_fs_close(NULL, &req, lg->fd, NULL);
+  uv_fs_req_cleanup(&req);
+  lg->fd = -1;
+  atomic_store(&lg->stop, false);
+}
+
+static void on_log_close(uv_handle_t *h) {
+  Log *lg = (Log *)h->data;
+  free(lg->path);
+  free(lg->ring);
+  free(lg);
+}
+
+// Flush on exit: the file thread is joined, stdout goes to its writer.
+static void log_free(Context *ctx) {
+  Log *lg = ctx->log;
+  if (!lg)
+    return;
+  if (lg->fd >= 0)
+    log_close_file(lg);
+  else
+    log_drain(lg, ctx_stdio(ctx, 1));
+  lg->check.data = lg;
+  uv_close((uv_handle_t *)&lg->check, on_log_close);
+  ctx->log = NULL;
+}
+
+static void log_record(Context *ctx, int level) {
+  Log *lg = log_get(ctx);
+  char *msg = pop_str_take(ctx);
+  if (level < lg->level) {
+    str_free(ctx, msg);
+    return;
+  }
+  uint64_t ms;
+  if (ctx->sim) {
+    ms = ctx->sim->now;
+  } else {
+    uv_timeval64_t tv;
+    uv_gettimeofday(&tv);
+    ms = (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_usec / 1000;
+  }
+  if ((int64_t)(ms / 1000) != lg->stamp_sec) {
+    lg->stamp_sec = (int64_t)(ms / 1000);
+    time_t t = (time_t)lg->stamp_sec;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(lg->stamp, sizeof(lg->stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+  }
+
+  char rec[LOG_MAX_RECORD];
+  int n = snprintf(rec, sizeof(rec), "ts=%s.%03uZ level=%s msg=\"", lg->stamp,
+                   (unsigned)(ms % 1000), log_level_names[level]);
+  size_t len = (size_t)n;
+  for (const char *p = msg; *p && len < sizeof(rec) - 4; p++) {
+    char c = *p;
+    if (c == '"' || c == '\\' || c == '\n') {
+      rec[len++] = '\\';
+      c = c == '\n' ? 'n' : c;
+    }
+    rec[len++] = c;
+  }
+  rec[len++] = '"';
+  rec[len++] = '\n';
+  str_free(ctx, msg);
+
+  size_t head = atomic_load_explicit(&lg->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&lg->tail, memory_order_acquire);
+  if (LOG_RING_SIZE - (head - tail) < len) {
+    lg->dropped++;
+    return;
+  }
+  size_t off = head & (LOG_RING_SIZE - 1);
+  size_t first = len < LOG_RING_SIZE - off ? len : LOG_RING_SIZE - off;
+  memcpy(lg->ring + off, rec, first);
+  memcpy(lg->ring, rec + first, len - first);
+  atomic_store_explicit(&lg->head, head + len, memory_order_release);
+  lg->records++;
+  // A burst inside one callback need not wait for the end of the turn.
+  if (lg->fd >= 0 && head + len - lg->kicked > LOG_RING_SIZE / 2)
+    log_flush(ctx);
+}
+
+// log:debug log:info log:warn log:error ( str -- )
+static void prim_log_debug(Context *ctx) { log_record(ctx, LOG_DEBUG); }
+static void prim_log_info(Context *ctx) { log_record(ctx, LOG_INFO); }
+static void prim_log_warn(Context *ctx) { log_record(ctx, LOG_WARN); }
+static void prim_log_error(Context *ctx) { log_record(ctx, LOG_ERROR); }
+
+// log:level ( name -- ): "debug", "info" (the default), "warn", "error" or
+// "off".
+static void prim_log_level(Context *ctx) {
+  char *name = pop_str_take(ctx);
+  int level = -1;
+  for (int i = LOG_DEBUG; i <= LOG_OFF; i++)
+    if (strcmp(name, log_level_names[i]) == 0)
+      level = i;
+  str_free(ctx, name);
+  if (level < 0)
+    fail(ctx, SF_ERR_TYPE, "log:level: expected debug, info, warn, error "
+                           "or off");
+  log_get(ctx)->level = level;
+}
+
+// Switch the log to a file, writing what is already logged first.
+static void log_open(Context *ctx, const char *path) {
+  Log *lg = log_get(ctx);
+  uv_fs_t req;
+  int fd = uv_fs_open(NULL, &req, path, O_WRONLY | O_CREAT | O_APPEND, 0644,
+                      NULL);
+  uv_fs_req_cleanup(&req);
+  if (fd < 0)
+    fail(ctx, SF_ERR_IO, "log:file: %s: %s", path, uv_strerror(fd));
+  if (lg->fd >= 0)
+    log_close_file(lg);
+  else
+    log_flush(ctx); // earlier records stay on stdout
+  lg->fd = fd;
+  lg->kicked = atomic_load(&lg->head);
+  if (uv_sem_init(&lg->wake, 0) || uv_thread_create(&lg->thread, log_thread,
+                                                    lg)) {
+    uv_fs_close(NULL, &req, fd, NULL);
+    uv_fs_req_cleanup(&req);
+    lg->fd = -1;
+    fail(ctx, SF_ERR_UV, "log:file: cannot start the writer thread");
+  }
+  free(lg->path);
+  lg->path = xstrdup(path);
+}
+
+// log:file ( path -- ): append records to a file from now on. Calling it
+// again reopens, which is how a rotated log is picked up.
+static void prim_log_file(Context *ctx) {
+  char *s = pop_str_take(ctx);
+  char path[4096];
+  snprintf(path, sizeof(path), "%s", s);
+  str_free(ctx, s);
+  log_open(ctx, path);
+}
+
+// Run a token stream through the interpreter once, trapping any error.
+static int run_stream(Context *ctx, TokStream *ts) {
+  jmp_buf trap;
+  jmp_buf *outer = ctx->trap;
+  volatile int rc = SF_OK;
+  int active = ctx->nactive;
+  ctx->trap = &trap;
+  meter_enter(ctx);
+  if (setjmp(trap) == 0)
+    exec_tokens(ctx, ts->toks, ts->count);
+  else
+    rc = ctx->err;
+  meter_leave(ctx);
+  ctx->trap = outer;
+  ctx->nactive = active;
+  retired_settle(ctx, outer);
+  if (!outer) {
+    log_flush(ctx);
+    stdio_flush(ctx);
+  }
+  return rc;
+}
+
+// ---------------- Remote REPL ----------------
+// repl:serve listens on a TCP address or a Unix socket path and gives every
+// client an interpreter session on this context and its loop: each line is
+// evaluated as it arrives, between other events, and what it prints is sent
+// back. Sessions share the script's dictionary and data stack, so `.s`,
+// `handles` and `stats` show the live state and a new definition takes
+// effect for every handle at once. Errors are reported to the session
+// only; `bye` stops the script itself.
+//
+// The interactive prompt (sf_repl_stdio) is the same kind of session
+// reading stdin, except that its output goes to the context's own sink.
+
+#define REPL_MAX_LINE 65536
+
+struct Repl {
+  char *in; // received text not yet ended by a newline
+  size_t in_len, in_cap;
+  char *out; // output of the lines being evaluated
+  size_t out_len, out_cap;
+  bool local; // the stdin session: no capture, errors to stderr
+  bool tty;   // ... reading a terminal, where end of input means bye
+};
+
+static void repl_free(Context *ctx, Repl *r) {
+  if (!r)
+    return;
+  mem_release(ctx, sizeof(Repl) + r->in_cap + r->out_cap);
+  free(r->in);
+  free(r->out);
+  free(r);
+}
+
+static void buf_append(Context *ctx, char **buf, size_t *len, size_t *cap,
+                       const char *s, size_t n) {
+  if (*len + n > *cap) {
+    size_t ncap = *cap ? *cap : 256;
+    while (ncap < *len + n)
+      ncap *= 2;
+    char *p = (char *)realloc(*buf, ncap);
+    if (!p)
+      oom();
+    mem_charge(ctx, ncap - *cap);
+    *buf = p;
+    *cap = ncap;
+  }
+  memcpy(*buf + *len, s, n);
+  *len += n;
+}
+
+static void repl_sink(SfContext *ctx, const char *s, size_t n, void *data) {
+  Repl *r = (Repl *)data;
+  buf_append(ctx, &r->out, &r->out_len, &r->out_cap, s, n);
+}
+
+// Send the session's output followed by a prompt.
+static void repl_send(Handle *h) {
+  Context *ctx = h->ctx;
+  Repl *r = h->repl;
+  if (r->local) {
+    out_puts(ctx, "> ");
+    out_flush(ctx);
+    return;
+  }
+  repl_sink(ctx, "> ", 2, r);
+  char *s = str_alloc(ctx, r->out_len);
+  memcpy(s, r->out, r->out_len);
+  uv_buf_t buf = uv_buf_init(s, (unsigned int)r->out_len);
+  r->out_len = 0;
+  uv_write_t *req = (uv_write_t *)xcalloc(1, sizeof(uv_write_t));
+  req->data = s;
+  mem_charge(ctx, sizeof(uv_write_t));
+  if (uv_write(req, &h->u.stream, &buf, 1, on_write)) {
+    mem_release(ctx, sizeof(uv_write_t));
+    free(req);
+    str_free(ctx, s);
+  }
+}
+
+static void repl_eval(Handle *h, const char *line) {
+  Context *ctx = h->ctx;
+  if (h->repl->local) {
+    if (sf_eval(ctx, line) != SF_OK)
+      err_printf(ctx, "%s\n", ctx->errmsg);
+    return;
+  }
+  SfOutputFn out = ctx->out;
+  void *out_data = ctx->out_data;
+  ctx->out = repl_sink;
+  ctx->out_data = h->repl;
+  int rc = sf_eval(ctx, line);
+  ctx->out = out;
+  ctx->out_data = out_data;
+  if (rc != SF_OK) {
+    repl_sink(ctx, "error: ", 7, h->repl);
+    repl_sink(ctx, ctx->errmsg, strlen(ctx->errmsg), h->repl);
+    repl_sink(ctx, "\n", 1, h->repl);
+  }
+}
+
+static void on_repl_read(uv_stream_t *stream, ssize_t nread,
+                         const uv_buf_t *buf) {
+  Handle *h = (Handle *)stream->data;
+  Context *ctx = h->ctx;
+  if (nread > 0 && ctx) {
+    Repl *r = h->repl;
+    buf_append(ctx, &r->in, &r->in_len, &r->in_cap, buf->base,
+               (size_t)nread);
+    size_t start = 0;
+    for (size_t i = 0; i < r->in_len && ctx->running; i++) {
+      if (r->in[i] != '\n')
+        continue;
+      r->in[i] = '\0';
+      repl_eval(h, r->in + start);
+      start = i + 1;
+    }
+    memmove(r->in, r->in + start, r->in_len - start);
+    r->in_len -= start;
+    if (r->in_len > REPL_MAX_LINE) {
+      r->in_len = 0;
+      repl_sink(ctx, "error: line too long\n", 21, r);
+      start = 1;
+    }
+    if (start > 0)
+      repl_send(h);
+  } else if (nread < 0) {
+    uv_read_stop(stream);
+    Repl *r = h->repl;
+    if (ctx && r->local && r->in_len > 0 && ctx->running) {
+      buf_append(ctx, &r->in, &r->in_len, &r->in_cap, "", 1);
+      repl_eval(h, r->in); // a last line without a newline
+    }
+    if (ctx && r->tty)
+      prim_bye(ctx);
+    if (!uv_is_closing(&h->u.base))
+      uv_close(&h->u.base, on_close_free);
+  }
+  if (buf->base) {
+    mem_release(ctx, buf->len);
+    free(buf->base);
+  }
+}
+
+static void on_repl_connection(uv_stream_t *server, int status) {
+  Handle *hs = (Handle *)server->data;
+  Context *ctx = hs->ctx;
+  if (status < 0 || !ctx)
+    return;
+  Handle *hc = handle_new(ctx, HND_REPL);
+  if (server->type == UV_NAMED_PIPE)
+    uv_pipe_init(ctx->loop, &hc->u.pipe, 0);
+  else
+    uv_tcp_init(ctx->loop, &hc->u.tcp);
+  hc->u.base.data = hc;
+  if (uv_accept(server, &hc->u.stream) != 0 ||
+      uv_read_start(&hc->u.stream, on_alloc, on_repl_read) != 0) {
+    uv_close(&hc->u.base, on_close_free);
+    return;
+  }
+  hc->repl = (Repl *)xcalloc(1, sizeof(Repl));
+  mem_charge(ctx, sizeof(Repl));
+  repl_send(hc);
+}
+
+// repl:serve ( addr -- h ): addr is "ip:port", or a socket path (any
+// address containing "/"). uv:close stops listening; open sessions stay.
+static void prim_repl_serve(Context *ctx) {
+  char *s = pop_str_take(ctx);
+  char addr[4096];
+  snprintf(addr, sizeof(addr), "%s", s);
+  str_free(ctx, s);
+  if (ctx->sim)
+    fail(ctx, SF_ERR_UV, "repl:serve: not available in simulation");
+  bool is_pipe = strchr(addr, '/') != NULL;
+  struct sockaddr_in sa;
+  if (!is_pipe) {
+    char *colon = strrchr(addr, ':');
+    if (!colon)
+      fail(ctx, SF_ERR_SYNTAX, "repl:serve: expected ip:port or a path");
+    *colon = '\0';
+    int rc = uv_ip4_addr(addr, atoi(colon + 1), &sa);
+    if (rc)
+      fail(ctx, SF_ERR_UV, "repl:serve: %s: %s", addr, uv_strerror(rc));
+  }
+
+  Handle *h = handle_new(ctx, HND_REPL);
+  int rc;
+  if (is_pipe) {
+    uv_pipe_init(ctx->loop, &h->u.pipe, 0);
+    // A socket file left behind by an earlier run would block the bind.
+    struct stat st;
+    if (stat(addr, &st) == 0 && S_ISSOCK(st.st_mode))
+      unlink(addr);
+    rc = uv_pipe_bind(&h->u.pipe, addr);
+  } else {
+    uv_tcp_init(ctx->loop, &h->u.tcp);
+    rc = uv_tcp_bind(&h->u.tcp, (const struct sockaddr *)&sa, 0);
+  }
+  h->u.base.data = h;
+  if (!rc)
+    rc = uv_listen(&h->u.stream, 16, on_repl_connection);
+  if (rc) {
+    uv_close(&h->u.base, on_close_free);
+    fail(ctx, SF_ERR_UV, "repl:serve: %s", uv_strerror(rc));
+  }
+  push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+}
+
+// ---------------- Signals ----------------
+// uv:signal runs a quote with ( h signum ) whenever the process receives a
+// signal, like a timer tick. signal:defaults installs the operational
+// handlers: SIGTERM drains, SIGHUP reloads every watched script and
+// reopens the log:file, SIGUSR1 writes `stats` and `handles` to stderr.
+// These don't keep the loop alive on their own.
+
+static int signal_number(Context *ctx) {
+  static const struct {
+    const char *name;
+    int num;
+  } names[] = {{"HUP", SIGHUP},   {"INT", SIGINT},   {"QUIT", SIGQUIT},
+               {"TERM", SIGTERM}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2},
+               {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"CHLD", SIGCHLD}};
+  Value v = pop(ctx, &ctx->ds);
+  if (v.type == VAL_INT)
+    return (int)v.as.i;
+  if (v.type != VAL_STRING)
+    fail(ctx, SF_ERR_TYPE, "type error: expected signal number or name");
+  const char *name = v.as.s;
+  if (strncmp(name, "SIG", 3) == 0)
+    name += 3;
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcmp(names[i].name, name) == 0) {
+      str_free(ctx, v.as.s);
+      return names[i].num;
+    }
+  }
+  char bad[64];
+  snprintf(bad, sizeof(bad), "%s", v.as.s);
+  str_free(ctx, v.as.s);
+  fail(ctx, SF_ERR_TYPE, "unknown signal: %s", bad);
+}
+
+static void on_signal(uv_signal_t *sig, int signum) {
+  Handle *h = (Handle *)sig->data;
+  Context *ctx = h->ctx;
+  if (!ctx)
+    return;
+  if (h->native) {
+    h->native(h, signum);
+  } else if (h->cb1) {
+    push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+    push(&ctx->ds, VInt(signum));
+    run_callback(ctx, h->cb1, 2);
+  }
+}
+
+static Handle *signal_start(Context *ctx, int signum, Quote *q,
+                            void (*native)(Handle *, int)) {
+  Handle *h = handle_new(ctx, HND_SIGNAL);
+  uv_signal_init(ctx->loop, &h->u.signal);
+  h->u.signal.data = h;
+  h->cb1 = q;
+  h->native = native;
+  int rc = uv_signal_start(&h->u.signal, on_signal, signum);
+  if (rc) {
+    uv_close(&h->u.base, on_close_free);
+    fail(ctx, SF_ERR_UV, "uv_signal_start: %s", uv_strerror(rc));
+  }
+  return h;
+}
+
+// uv:signal ( signum q -- h ): signum is a number or a name like "TERM" or
+// "SIGHUP". uv:close stops handling it.
+static void prim_uv_signal(Context *ctx) {
+  Quote *q = pop_quote(ctx);
+  int signum;
+  jmp_buf trap;
+  jmp_buf *outer = ctx->trap;
+  ctx->trap = &trap;
+  if (setjmp(trap) != 0) { // don't leak the quote on a bad signal name
+    ctx->trap = outer;
+    quote_release(q);
+    rethrow(ctx);
+  }
+  signum = signal_number(ctx);
+  ctx->trap = outer;
+  Handle *h = signal_start(ctx, signum, q, NULL);
+  push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+}
+
+// ---------------- Foreign descriptors ----------------
+// uv:poll watches a descriptor that other code reads and writes, such as a
+// database driver's socket, on the same loop as everything else. The quote
+// runs with ( h events ) each time the descriptor is ready, where events
+// are the libuv flags: 1 readable, 2 writable, 4 disconnect, 8 priority,
+// or a negative libuv error code. Closing the handle leaves the descriptor
+// open; it still belongs to whoever gave it.
+
+#define POLL_EVENTS_ALL \
+  (UV_READABLE | UV_WRITABLE | UV_DISCONNECT | UV_PRIORITIZED)
+
+static int poll_events(Context *ctx) {
+  Value v = pop(ctx, &ctx->ds);
+  if (v.type == VAL_INT) {
+    if (v.as.i < 0 || (v.as.i & ~(int64_t)POLL_EVENTS_ALL))
+      fail(ctx, SF_ERR_TYPE, "poll events: unknown flags in %lld",
+           (long long)v.as.i);
+    return (int)v.as.i;
+  }
+  if (v.type != VAL_STRING)
+    fail(ctx, SF_ERR_TYPE, "type error: expected poll events");
+  int events = 0;
+  char bad = 0;
+  for (const char *c = v.as.s; *c && !bad; c++) {
+    switch (*c) {
+    case 'r':
+      events |= UV_READABLE;
+      break;
+    case 'w':
+      events |= UV_WRITABLE;
+      break;
+    case 'd':
+      events |= UV_DISCONNECT;
+      break;
+    case 'p':
+      events |= UV_PRIORITIZED;
+      break;
+    default:
+      bad = *c;
+    }
+  }
+  str_free(ctx, v.as.s);
+  if (bad)
+    fail(ctx, SF_ERR_TYPE, "poll events: unknown flag '%c'", bad);
+  return events;
+}
+
+static void on_poll(uv_poll_t *p, int status, int events) {
+  Handle *h = (Handle *)p->data;
+  Context *ctx = h->ctx;
+  if (!ctx || !h->cb1)
+    return;
+  push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+  push(&ctx->ds, VInt(status < 0 ? status : events));
+  run_callback(ctx, h->cb1, 2);
+}
+
+// Start, change or (with no events) stop watching.
+static void poll_set(Context *ctx, Handle *h, int events) {
+  int rc = events ? uv_poll_start(&h->u.poll, events, on_poll)
+                  : uv_poll_stop(&h->u.poll);
+  if (rc)
+    fail(ctx, SF_ERR_UV, "uv_poll_start: %s", uv_strerror(rc));
+}
+
+// uv:poll ( fd events q -- h ): events is a number or letters, "r", "w",
+// "rw", with "d" for disconnect and "p" for priority data.
+static void prim_uv_poll(Context *ctx) {
+  Quote *q = pop_quote(ctx);
+  int events;
+  int64_t fd;
+  jmp_buf trap;
+  jmp_buf *outer = ctx->trap;
+  ctx->trap = &trap;
+  if (setjmp(trap) != 0) {
+    ctx->trap = outer;
+    quote_release(q);
+    rethrow(ctx);
+  }
+  events = poll_events(ctx);
+  fd = pop_int(ctx);
+  if (fd < 0 || fd > INT_MAX)
+    fail(ctx, SF_ERR_TYPE, "uv:poll: bad descriptor %lld", (long long)fd);
+  if (ctx->sim)
+    fail(ctx, SF_ERR_UV, "uv:poll: not available in simulation");
+  Handle *h = handle_new(ctx, HND_POLL);
+  int rc = uv_poll_init(ctx->loop, &h->u.poll, (int)fd);
+  if (rc) {
+    handle_free(h);
+    fail(ctx, SF_ERR_UV, "uv_poll_init: %s", uv_strerror(rc));
+  }
+  ctx->trap = outer;
+  h->u.poll.data = h;
+  h->cb1 = q;
+  rc = events ? uv_poll_start(&h->u.poll, events, on_poll) : 0;
+  if (rc) {
+    uv_close(&h->u.base, on_close_free);
+    fail(ctx, SF_ERR_UV, "uv_poll_start: %s", uv_strerror(rc));
+  }
+  push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+}
+
+// uv:poll-events ( h events -- ): watch for other events, e.g. "rw" while a
+// driver has output queued and "r" once it is flushed; 0 pauses.
+static void prim_uv_poll_events(Context *ctx) {
+  int events = poll_events(ctx);
+  Handle *h = pop_handle(ctx, HND_POLL);
+  poll_set(ctx, h, events);
+}
+
+// ---------------- Shared-memory rings ----------------
+// shm:ring makes a ring buffer in POSIX shared memory. Other processes on
+// the host open it by name with shm:open and append messages with
+// shm:send; the process that made it runs its quote on each one. A
+// message costs one copy in and one copy out, with no system call while
+// the reader is busy. Producers serialize on a robust mutex in the shared
+// header, so any number may write, and there is one reader; the tail only
+// moves past whole records, so a producer killed while appending costs
+// nothing but its message. An idle reader
+// sleeps on a FIFO doorbell watched with uv_poll. It sets `waiting` first,
+// and a producer rings the doorbell only after clearing that flag, so each
+// sleep costs at most one wakeup.
+
+#define RING_MAGIC 0x53465231u // "SFR1"
+#define RING_WRAP 0xFFFFFFFFu  // the rest of the buffer is unused
+#define RING_MIN 4096
+#define RING_MAX (1u << 30)
+#define RING_BATCH 1024 // messages per wakeup before yielding to the loop
+
+// Records are a 32-bit length, 4 bytes of padding and the message,
+// rounded up to 8 bytes. None wraps around the end of the buffer.
+typedef struct {
+  uint32_t magic;
+  uint32_t size;             // bytes in data[]
+  _Atomic uint64_t head;     // read offset, only ever increasing
+  _Atomic uint64_t tail;     // write offset, stored after the record
+  pthread_mutex_t lock;      // held by a producer while appending
+  _Atomic uint32_t waiting;  // the reader is asleep: ring the doorbell
+  _Atomic uint64_t sent;     // messages appended
+  _Atomic uint64_t full;     // sends refused for lack of space
+  char data[];
+} RingHdr;
+
+struct Ring {
+  RingHdr *hdr;
+  size_t map_len;
+  uint32_t size; // hdr->size as checked on opening; others can write hdr
+  int bell;   // the doorbell FIFO, open read-write
+  bool owner; // the reader; removes the names when closed
+  char shm[64];
+  char bell_path[96];
+};
+
+static uint64_t ring_record(uint32_t len) {
+  return 8 + (((uint64_t)len + 7) & ~(uint64_t)7);
+}
+
+// Remove the names, so no one else opens the ring; mappings stay valid.
+static void ring_unlink(Ring *r) {
+  if (!r || !r->owner)
+    return;
+  shm_unlink(r->shm);
+  unlink(r->bell_path);
+  r->owner = false;
+}
+
+static void ring_free(Ring *r) {
+  if (!r)
+    return;
+  ring_unlink(r);
+  if (r->hdr)
+    munmap(r->hdr, r->map_len);
+  if (r->bell >= 0)
+    close(r->bell);
+  free(r);
+}
+
+// The doorbell sits in a directory anyone can write to: only a FIFO of
+// ours is one. The sticky bit keeps others from replacing it once made.
+static bool ring_bell_ours(int fd) {
+  struct stat st;
+  return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode) &&
+         st.st_uid == geteuid();
+}
+
+// Map the ring called `name`: create it (with `size` bytes of buffer) as
+// its reader, or open an existing one as a producer when size is 0. Making
+// a ring again replaces the old one, which a reader that crashed leaves
+// behind.
+static Ring *ring_open(Context *ctx, const char *name, uint32_t size) {
+  for (const char *c = name; *c; c++)
+    if (!isalnum((unsigned char)*c) && !strchr("-_.", *c))
+      fail(ctx, SF_ERR_TYPE, "shm: bad ring name: %s", name);
+  if (!*name || strlen(name) > 48)
+    fail(ctx, SF_ERR_TYPE, "shm: bad ring name: %s", name);
+  Ring *r = (Ring *)xcalloc(1, sizeof(Ring));
+  r->bell = -1;
+  r->owner = size > 0;
+  snprintf(r->shm, sizeof(r->shm), "/solarforth-%s", name);
+  snprintf(r->bell_path, sizeof(r->bell_path),
+           "/dev/shm/solarforth-%s.bell", name);
+  const char *what = "shm_open";
+  int fd;
+  if (r->owner) {
+    shm_unlink(r->shm);
+    unlink(r->bell_path);
+    r->map_len = sizeof(RingHdr) + size;
+    fd = shm_open(r->shm, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0 && ftruncate(fd, (off_t)r->map_len) != 0) {
+      what = "ftruncate";
+      close(fd);
+      fd = -1;
+    }
+    if (fd >= 0 && mkfifo(r->bell_path, 0600) != 0) {
+      what = "mkfifo";
+      close(fd);
+      fd = -1;
+    }
+  } else {
+    struct stat st;
+    fd = shm_open(r->shm, O_RDWR, 0);
+    if (fd >= 0 && fstat(fd, &st) == 0)
+      r->map_len = (size_t)st.st_size;
+  }
+  if (fd >= 0) {
+    void *map = r->map_len > sizeof(RingHdr)
+                    ? mmap(NULL, r->map_len, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0)
+                    : MAP_FAILED;
+    close(fd);
+    what = "mmap";
+    if (map != MAP_FAILED)
+      r->hdr = (RingHdr *)map;
   }
+  if (r->hdr) {
+    what = "doorbell";
+    r->bell = open(r->bell_path, O_RDWR | O_NONBLOCK | O_NOFOLLOW);
+    if (r->bell >= 0 && !ring_bell_ours(r->bell)) {
+      close(r->bell);
+      r->bell = -1;
+      errno = EPERM;
+    }
+  }
+  int err = errno;
+  if (r->bell < 0) {
+    ring_free(r);
+    fail(ctx, SF_ERR_IO, "shm %s: %s: %s", name, what, strerror(err));
+  }
+  RingHdr *hd = r->hdr;
+  if (r->owner) {
+    hd->magic = RING_MAGIC;
+    hd->size = size;
+    r->size = size;
+    atomic_init(&hd->head, 0);
+    atomic_init(&hd->tail, 0);
+    pthread_mutexattr_t a;
+    pthread_mutexattr_init(&a);
+    pthread_mutexattr_setpshared(&a, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&a, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&hd->lock, &a);
+    pthread_mutexattr_destroy(&a);
+    atomic_init(&hd->waiting, 1);
+    atomic_init(&hd->sent, 0);
+    atomic_init(&hd->full, 0);
+  } else {
+    r->size = hd->size;
+    if (hd->magic != RING_MAGIC || r->size % 8 ||
+        sizeof(RingHdr) + r->size != r->map_len) {
+      ring_free(r);
+      fail(ctx, SF_ERR_IO, "shm %s: not a ring", name);
+    }
+  }
+  return r;
 }
 
-// Provide a buffer to libuv’s read machinery.
-static void on_alloc(uv_handle_t *handle, size_t suggested_size,
-                     uv_buf_t *buf) {
-  (void)handle;
-  buf->base = (char *)malloc(suggested_size);
-  buf->len = suggested_size;
+// Wake the reader. A FIFO too full to take the byte is already readable.
+static void ring_bell(Ring *r) {
+  ssize_t n = write(r->bell, "", 1);
+  (void)n;
 }
 
-static void on_write(uv_write_t *req, int status) {
-  if (req->data)
-    free(req->data);
-  free(req);
-  if (status < 0) { /* ignore */
+// Append a message; NULL, or why it could not be.
+static const char *ring_send(Ring *r, const char *msg, uint32_t len) {
+  RingHdr *hd = r->hdr;
+  uint64_t need = ring_record(len);
+  int rc = pthread_mutex_lock(&hd->lock);
+  if (rc == EOWNERDEAD) // the holder died appending, before moving the tail
+    rc = pthread_mutex_consistent(&hd->lock);
+  if (rc)
+    return strerror(rc);
+  uint64_t tail = atomic_load_explicit(&hd->tail, memory_order_relaxed);
+  uint64_t head = atomic_load_explicit(&hd->head, memory_order_acquire);
+  uint32_t pos = (uint32_t)(tail % r->size);
+  uint64_t skip = r->size - pos < need ? r->size - pos : 0;
+  bool ok = tail + skip + need - head <= r->size;
+  if (ok) {
+    if (skip) {
+      uint32_t wrap = RING_WRAP;
+      memcpy(hd->data + pos, &wrap, 4);
+      pos = 0;
+    }
+    memcpy(hd->data + pos, &len, 4);
+    memcpy(hd->data + pos + 8, msg, len);
+    atomic_store(&hd->tail, tail + skip + need);
+  }
+  pthread_mutex_unlock(&hd->lock);
+  if (!ok) {
+    atomic_fetch_add_explicit(&hd->full, 1, memory_order_relaxed);
+    return "ring full";
   }
+  atomic_fetch_add_explicit(&hd->sent, 1, memory_order_relaxed);
+  if (atomic_exchange(&hd->waiting, 0))
+    ring_bell(r);
+  return NULL;
 }
 
-// When data arrives (or EOF), translate it into stack values and run the quote.
-static void on_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
-  Handle *h = (Handle *)stream->data;
-  if (nread > 0) {
-    char *s = (char *)xmalloc((size_t)nread + 1);
-    memcpy(s, buf->base, (size_t)nread);
-    s[nread] = '\0';
-    push(&h->ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
-    push(&h->ctx->ds, VStrTake(s));
-    if (h->cb1)
-      exec_quote(h->ctx, h->cb1);
-  } else if (nread == UV_EOF) {
+// A record that does not fit between head and tail, so some process wrote
+// over the ring: drop everything queued and report it.
+static void ring_corrupt(Handle *h, uint64_t tail) {
+  Context *ctx = h->ctx;
+  atomic_store(&h->ring->hdr->head, tail);
+  ctx->err = SF_ERR_IO;
+  snprintf(ctx->errmsg, sizeof(ctx->errmsg),
+           "shm %s: bad record, queued messages dropped",
+           h->ring->shm + strlen("/solarforth-"));
+  callback_failed(ctx);
+}
 
-    push(&h->ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
-    push(&h->ctx->ds, VStr(""));
-    if (h->cb1)
-      exec_quote(h->ctx, h->cb1);
-    uv_read_stop(stream);
-  } else if (nread < 0) { /* error */
+// The doorbell rang (or the last batch was cut short): run the quote on
+// every message, then go back to sleep.
+static void on_ring(uv_poll_t *p, int status, int events) {
+  (void)status;
+  (void)events;
+  Handle *h = (Handle *)p->data;
+  Context *ctx = h->ctx;
+  Ring *r = h->ring;
+  if (!ctx)
+    return;
+  char drain[64];
+  while (read(r->bell, drain, sizeof(drain)) > 0)
+    ;
+  RingHdr *hd = r->hdr;
+  uint32_t size = r->size;
+  for (int n = 0; !uv_is_closing(&h->u.base);) {
+    uint64_t head = atomic_load_explicit(&hd->head, memory_order_relaxed);
+    uint64_t tail = atomic_load(&hd->tail);
+    if (head == tail) {
+      atomic_store(&hd->waiting, 1);
+      if (head == atomic_load(&hd->tail))
+        return;
+      atomic_store(&hd->waiting, 0);
+      continue;
+    }
+    if (n++ == RING_BATCH) { // let the loop run; ring to come back
+      ring_bell(r);
+      return;
+    }
+    uint32_t pos = (uint32_t)(head % size);
+    uint32_t len;
+    memcpy(&len, hd->data + pos, 4);
+    uint64_t rec = len == RING_WRAP ? size - pos : ring_record(len);
+    if (tail - head > size || rec > tail - head || pos + rec > size) {
+      ring_corrupt(h, tail);
+      continue; // then sleep as usual
+    }
+    if (len == RING_WRAP) {
+      atomic_store_explicit(&hd->head, head + rec, memory_order_release);
+      continue;
+    }
+    char *s = str_alloc(ctx, len);
+    memcpy(s, hd->data + pos + 8, len);
+    atomic_store_explicit(&hd->head, head + rec, memory_order_release);
+    push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
+    push(&ctx->ds, VStrTake(s));
+    run_callback(ctx, h->cb1, 2);
   }
-  if (buf->base)
-    free(buf->base);
 }
 
-static void prim_uv_read_start(Context *ctx) {
-  Quote *q = pop_quote(ctx);
-  Handle *h = pop_handle(ctx, HND_TCP);
-  if (h->cb1)
-    quote_free(h->cb1);
+static Handle *ring_handle(Context *ctx, Ring *r, Quote *q) {
+  Handle *h = handle_new(ctx, HND_RING);
+  int rc = uv_poll_init(ctx->loop, &h->u.poll, r->bell);
+  if (rc) {
+    ring_free(r);
+    handle_free(h);
+    fail(ctx, SF_ERR_UV, "uv_poll_init: %s", uv_strerror(rc));
+  }
+  h->u.poll.data = h;
+  h->ring = r;
   h->cb1 = q;
-  int rc = uv_read_start((uv_stream_t *)&h->u.tcp, on_alloc, on_read);
+  rc = q ? uv_poll_start(&h->u.poll, UV_READABLE, on_ring) : 0;
   if (rc) {
-    fprintf(stderr, "uv_read_start: %s\n", uv_strerror(rc));
+    uv_close(&h->u.base, on_close_free);
+    fail(ctx, SF_ERR_UV, "uv_poll_start: %s", uv_strerror(rc));
   }
+  return h;
 }
 
-// Accept a new client and run the server’s quotation with the client handle.
-static void on_connection(uv_stream_t *server, int status) {
-  if (status < 0)
+static void out_ring(Context *ctx, const Handle *h) {
+  RingHdr *hd = h->ring->hdr;
+  out_printf(ctx, " %s used %llu/%u sent %llu full %llu",
+             h->ring->shm + strlen("/solarforth-"),
+             (unsigned long long)(atomic_load(&hd->tail) -
+                                  atomic_load(&hd->head)),
+             h->ring->size, (unsigned long long)atomic_load(&hd->sent),
+             (unsigned long long)atomic_load(&hd->full));
+}
+
+static void pop_ring_name(Context *ctx, char *name, size_t n) {
+  char *s = pop_str_take(ctx);
+  snprintf(name, n, "%s", s);
+  str_free(ctx, s);
+}
+
+// shm:ring ( name bytes q -- h ): make the ring `name` and read it.
+static void prim_shm_ring(Context *ctx) {
+  Quote *q = pop_quote(ctx);
+  char name[64];
+  jmp_buf trap;
+  jmp_buf *outer = ctx->trap;
+  ctx->trap = &trap;
+  if (setjmp(trap) != 0) {
+    ctx->trap = outer;
+    quote_release(q);
+    rethrow(ctx);
+  }
+  int64_t bytes = pop_int(ctx);
+  pop_ring_name(ctx, name, sizeof(name));
+  if (ctx->sim)
+    fail(ctx, SF_ERR_UV, "shm:ring: not available in simulation");
+  if (bytes < RING_MIN || bytes > RING_MAX)
+    fail(ctx, SF_ERR_TYPE, "shm:ring: size must be %u to %u bytes",
+         RING_MIN, RING_MAX);
+  Ring *r = ring_open(ctx, name, ((uint32_t)bytes + 7) & ~7u);
+  ctx->trap = outer;
+  push(&ctx->ds, (Value){.type = VAL_HANDLE, .as.h = ring_handle(ctx, r, q)});
+}
+
+// shm:open ( name -- h ): open another process's ring to send to it.
+static void prim_shm_open(Context *ctx) {
+  char name[64];
+  pop_ring_name(ctx, name, sizeof(name));
+  Ring *r = ring_open(ctx, name, 0);
+  push(&ctx->ds,
+       (Value){.type = VAL_HANDLE, .as.h = ring_handle(ctx, r, NULL)});
+}
+
+// shm:send ( h str -- ): fails when the reader has fallen a ring behind.
+static void prim_shm_send(Context *ctx) {
+  char *s = pop_str_take(ctx);
+  Handle *h = pop_handle(ctx, HND_RING);
+  size_t len = strlen(s);
+  const char *why = len + 8 <= h->ring->size / 2
+                        ? ring_send(h->ring, s, (uint32_t)len)
+                        : "message too large";
+  str_free(ctx, s);
+  if (why)
+    fail(ctx, SF_ERR_IO, "shm:send: %s", why);
+}
+
+// Sessions and connections a drain waits for.
+static bool is_connection(const Handle *h) {
+  if (uv_is_closing(&h->u.base))
+    return false;
+  if (h->type == HND_TCP)
+    return !h->listening && !h->eof;
+  return h->type == HND_REPL && h->repl && !h->repl->local;
+}
+
+// Once the last connection of a draining context is gone, leave uv:run.
+static void drain_check(Context *ctx) {
+  if (!ctx || !ctx->draining)
     return;
-  Handle *hs = (Handle *)server->data;
-  Handle *hc = handle_new(hs->ctx, HND_TCP);
-  uv_tcp_init(hs->ctx->loop, &hc->u.tcp);
-  hc->u.tcp.data = hc;
-  if (uv_accept(server, (uv_stream_t *)&hc->u.tcp) == 0) {
-    push(&hs->ctx->ds, (Value){.type = VAL_HANDLE, .as.h = hc});
-    if (hs->cb1)
-      exec_quote(hs->ctx, hs->cb1);
-  } else {
-    uv_close(&hc->u.base, on_close_free);
+  for (Handle *h = ctx->handles; h; h = h->next)
+    if (is_connection(h))
+      return;
+  prim_bye(ctx);
+}
+
+// drain ( ms -- ): stop accepting connections and watching files, let the
+// open connections finish, then `bye`; after ms milliseconds, `bye` anyway.
+static void prim_drain(Context *ctx) {
+  int64_t ms = pop_int(ctx);
+  if (ctx->draining)
+    return;
+  ctx->draining = true;
+  for (Handle *h = ctx->handles; h; h = h->next) {
+    if (uv_is_closing(&h->u.base))
+      continue;
+    if ((h->type == HND_TCP && h->listening) ||
+        (h->type == HND_REPL && !h->repl) || h->type == HND_FS_EVENT)
+      handle_close(ctx, h);
   }
+  Handle *t = handle_new(ctx, HND_TIMER);
+  uv_timer_init(ctx->loop, &t->u.timer);
+  t->u.timer.data = t;
+  t->cb1 = quote_new();
+  quote_add_token(t->cb1, "drop");
+  quote_add_token(t->cb1, "bye");
+  if (ctx->sim)
+    sim_timer_start(ctx, t, (uint64_t)ms, 0);
+  else
+    uv_timer_start(&t->u.timer, on_timer, (uint64_t)ms, 0);
+  drain_check(ctx);
 }
 
-static void prim_uv_listen(Context *ctx) {
-  Quote *q = pop_quote(ctx);
-  int64_t backlog = pop_int(ctx);
-  Handle *h = pop_handle(ctx, HND_TCP);
-  if (h->cb1)
-    quote_free(h->cb1);
-  h->cb1 = q;
-  int rc = uv_listen((uv_stream_t *)&h->u.tcp, (int)backlog, on_connection);
-  if (rc) {
-    fprintf(stderr, "uv_listen: %s\n", uv_strerror(rc));
+#define DRAIN_DEFAULT_MS 10000
+
+// SIGTERM: drain; a second SIGTERM exits at once.
+static void on_sigterm(Handle *h, int signum) {
+  (void)signum;
+  Context *ctx = h->ctx;
+  if (ctx->draining) {
+    prim_bye(ctx);
+    return;
   }
+  err_printf(ctx, "SIGTERM: draining (up to %d ms)\n", DRAIN_DEFAULT_MS);
+  push(&ctx->ds, VInt(DRAIN_DEFAULT_MS));
+  prim_drain(ctx);
 }
 
-typedef struct {
-  uv_connect_t req;
-  Handle *h;
-} ConnectReq;
+// SIGUSR1: dump the counters and live handles to stderr.
+static void on_sigusr1(Handle *h, int signum) {
+  (void)signum;
+  Context *ctx = h->ctx;
+  SfOutputFn out = ctx->out;
+  void *out_data = ctx->out_data;
+  ctx->out = stderr_sink;
+  prim_stats(ctx);
+  prim_handles(ctx);
+  ctx->out = out;
+  ctx->out_data = out_data;
+  writer_flush(ctx_stdio(ctx, 2));
+}
 
-// Outbound connect finished: on success, run the stored quotation.
-static void on_connect(uv_connect_t *req, int status) {
-  ConnectReq *cr = (ConnectReq *)req;
-  Handle *h = cr->h;
-  if (status == 0) {
-    push(&h->ctx->ds, (Value){.type = VAL_HANDLE, .as.h = h});
-    if (h->cb1)
-      exec_quote(h->ctx, h->cb1);
-  } else { /* ignore for now */
+// SIGHUP: reload every watched script and reopen the log file.
+static void on_sighup(Handle *h, int signum) {
+  (void)signum;
+  Context *ctx = h->ctx;
+  for (Handle *w = ctx->handles; w; w = w->next)
+    if (w->type == HND_FS_EVENT && !w->cb1 && !w->cached &&
+        !uv_is_closing(&w->u.base))
+      reload_reporting(ctx, w->path);
+  if (!ctx->log || !ctx->log->path)
+    return;
+  char path[4096]; // log_open replaces ctx->log->path
+  snprintf(path, sizeof(path), "%s", ctx->log->path);
+  jmp_buf trap;
+  jmp_buf *outer = ctx->trap;
+  ctx->trap = &trap;
+  if (setjmp(trap) == 0) {
+    log_open(ctx, path);
+  } else {
+    err_printf(ctx, "SIGHUP: %s\n", ctx->errmsg);
   }
-  free(cr);
+  ctx->trap = outer;
 }
 
-static void prim_uv_tcp_connect(Context *ctx) {
-  Quote *q = pop_quote(ctx);
-  int64_t port = pop_int(ctx);
-  char *ip = pop_str_take(ctx);
-  Handle *h = pop_handle(ctx, HND_TCP);
-  if (h->cb1)
-    quote_free(h->cb1);
-  h->cb1 = q;
-  struct sockaddr_in dest;
-  uv_ip4_addr(ip, (int)port, &dest);
-  free(ip);
-  ConnectReq *cr = (ConnectReq *)xcalloc(1, sizeof(ConnectReq));
-  cr->h = h;
-  int rc = uv_tcp_connect(&cr->req, &h->u.tcp, (const struct sockaddr *)&dest,
-                          on_connect);
-  if (rc) {
-    fprintf(stderr, "uv_tcp_connect: %s\n", uv_strerror(rc));
-    free(cr);
+// signal:defaults ( -- )
+static void prim_signal_defaults(Context *ctx) {
+  uv_unref(&signal_start(ctx, SIGTERM, NULL, on_sigterm)->u.base);
+  uv_unref(&signal_start(ctx, SIGHUP, NULL, on_sighup)->u.base);
+  uv_unref(&signal_start(ctx, SIGUSR1, NULL, on_sigusr1)->u.base);
+}
+
+// ---------------- Prefork workers ----------------
+
+// Under `solarforth --workers N` the script runs in N worker processes, each
+// with an IPC pipe to the master. uv:tcp-bind asks the master for the socket
+// instead of binding one: the master binds each address once and passes it
+// to every worker with uv_write2, so they all accept from the same queue.
+// The exchange runs on a private loop, as the word must return with the
+// socket in hand. Once a second the worker reports its stats for the master
+// to add up; if the master is gone, that write's SIGPIPE ends the worker.
+#define WORKER_REPORT_MS 1000
+
+typedef struct Worker {
+  uv_loop_t loop;    // private loop for the bind exchange
+  uv_pipe_t ipc;     // on `loop`
+  uv_timer_t report; // on the context's loop
+  char reply[256];
+  size_t len;
+} Worker;
+
+static void on_worker_alloc(uv_handle_t *handle, size_t suggested_size,
+                            uv_buf_t *buf) {
+  (void)suggested_size;
+  Worker *w = (Worker *)handle->data;
+  buf->base = w->reply + w->len;
+  buf->len = sizeof w->reply - 1 - w->len;
+}
+
+// Collect one reply line, then stop so the private loop returns.
+static void on_worker_read(uv_stream_t *s, ssize_t nread, const uv_buf_t *buf) {
+  (void)buf;
+  Worker *w = (Worker *)s->data;
+  if (nread < 0) {
+    w->len = (size_t)snprintf(w->reply, sizeof w->reply, "err %s\n",
+                              uv_strerror((int)nread));
+  } else {
+    w->len += (size_t)nread;
+    if (!memchr(w->reply, '\n', w->len) && w->len < sizeof w->reply - 1)
+      return;
   }
+  uv_read_stop(s);
 }
 
-static void prim_uv_write(Context *ctx) {
-  char *s = pop_str_take(ctx);
-  Handle *h = pop_handle(ctx, HND_TCP);
-  uv_write_t *req = (uv_write_t *)xcalloc(1, sizeof(uv_write_t));
-  uv_buf_t buf = uv_buf_init(s, (unsigned int)strlen(s));
-  req->data = s;
-  int rc = uv_write(req, (uv_stream_t *)&h->u.tcp, &buf, 1, on_write);
-  if (rc) {
-    fprintf(stderr, "uv_write: %s\n", uv_strerror(rc));
-    free(req);
-    free(s);
+// Replaces uv_tcp_bind for a worker: h receives the master's socket.
+static void worker_bind(Context *ctx, Handle *h,
+                        const struct sockaddr_in *addr) {
+  Worker *w = ctx->worker;
+  char ip[64], req[96];
+  uv_ip4_name(addr, ip, sizeof ip);
+  int n = snprintf(req, sizeof req, "bind %s %d\n", ip, ntohs(addr->sin_port));
+  uv_buf_t buf = uv_buf_init(req, (unsigned)n);
+  uv_write_t wr;
+  w->len = 0;
+  int rc = uv_write(&wr, (uv_stream_t *)&w->ipc, &buf, 1, NULL);
+  if (rc == 0 &&
+      (rc = uv_read_start((uv_stream_t *)&w->ipc, on_worker_alloc,
+                          on_worker_read)) != 0)
+    uv_run(&w->loop, UV_RUN_DEFAULT); // done with wr before failing
+  if (rc)
+    fail(ctx, SF_ERR_UV, "uv_tcp_bind: master: %s", uv_strerror(rc));
+  uv_run(&w->loop, UV_RUN_DEFAULT);
+  w->reply[w->len] = '\0';
+  w->reply[strcspn(w->reply, "\n")] = '\0';
+  if (strcmp(w->reply, "ok") != 0)
+    fail(ctx, SF_ERR_UV, "uv_tcp_bind: %s",
+         strncmp(w->reply, "err ", 4) == 0 ? w->reply + 4
+                                          : "master: bad reply");
+  if (uv_pipe_pending_count(&w->ipc) < 1 ||
+      uv_pipe_pending_type(&w->ipc) != UV_TCP)
+    fail(ctx, SF_ERR_UV, "uv_tcp_bind: master sent no socket");
+  // uv_accept wants both handles on one loop: take the socket on the
+  // private loop and give h its own descriptor for it.
+  uv_tcp_t tmp;
+  uv_os_fd_t fd = -1;
+  uv_tcp_init(&w->loop, &tmp);
+  rc = uv_accept((uv_stream_t *)&w->ipc, (uv_stream_t *)&tmp);
+  if (rc == 0 && (rc = uv_fileno((uv_handle_t *)&tmp, &fd)) == 0) {
+    fd = dup(fd);
+    rc = fd < 0 ? uv_translate_sys_error(errno) : 0;
   }
+  uv_close((uv_handle_t *)&tmp, NULL);
+  uv_run(&w->loop, UV_RUN_DEFAULT);
+  if (rc == 0 && (rc = uv_tcp_open(&h->u.tcp, fd)) != 0)
+    close(fd);
+  if (rc)
+    fail(ctx, SF_ERR_UV, "uv_tcp_bind: %s", uv_strerror(rc));
 }
 
-static void exec_tokens(Context *ctx, char **tokens, int count) {
-  CompileState cs = {0};
-  for (int i = 0; i < count; i++) {
-    char *t = tokens[i];
-    if (cs.compiling) {
-      if (strcmp(t, ";") == 0) {
-        dict_add_colon(ctx->dict, cs.name, cs.curr);
-        cs.compiling = false;
-        cs.curr = NULL;
-        continue;
-      }
-      if (strcmp(t, "[") == 0) {
-        Quote *qq = quote_new();
-
-        TokStream sub = {0};
-        sub.toks = &tokens[i + 1];
-        sub.count = count - (i + 1);
-        sub.idx = 0;
-        ts_init(&sub);
-
-        int depth = 1;
-        int j = i + 1;
-        while (j < count) {
-          if (strcmp(tokens[j], "[") == 0)
-            depth++;
-          else if (strcmp(tokens[j], "]") == 0) {
-            depth--;
-            if (depth == 0)
-              break;
-          }
-          quote_add_token(qq, tokens[j]);
-          j++;
-        }
-        if (depth != 0) {
-          fprintf(stderr, "unclosed quote in definition\n");
-          exit(1);
-        }
-        i = j;
+// A report is one short line; if the pipe is full, it is skipped.
+static void on_worker_report(uv_timer_t *t) {
+  Context *ctx = (Context *)t->data;
+  SfStats st;
+  sf_stats(ctx, &st);
+  char msg[256];
+  int n = snprintf(msg, sizeof msg,
+                   "stats %zu %zu %llu %u %llu %llu %llu %u %llu %llu\n",
+                   st.bytes,
+                   st.peak_bytes, (unsigned long long)st.cpu_ns, st.handles,
+                   (unsigned long long)st.out_dropped,
+                   (unsigned long long)st.log_records,
+                   (unsigned long long)st.log_dropped, st.loop_lag_ms,
+                   (unsigned long long)st.conn_rejected,
+                   (unsigned long long)st.stack_reclaimed);
+  uv_buf_t buf = uv_buf_init(msg, (unsigned)n);
+  uv_try_write((uv_stream_t *)&ctx->worker->ipc, &buf, 1);
+}
 
-        char buf[64];
-        snprintf(buf, sizeof(buf), "#Q:%p", (void *)qq);
-        quote_add_token(cs.curr, buf);
-        continue;
-      }
+static void on_worker_closed(uv_handle_t *handle) { free(handle->data); }
 
-      quote_add_token(cs.curr, t);
-      continue;
-    }
+static void worker_free(Context *ctx) {
+  Worker *w = ctx->worker;
+  if (!w)
+    return;
+  uv_close((uv_handle_t *)&w->ipc, NULL);
+  uv_run(&w->loop, UV_RUN_DEFAULT);
+  uv_loop_close(&w->loop);
+  w->report.data = w;
+  uv_close((uv_handle_t *)&w->report, on_worker_closed);
+  ctx->worker = NULL;
+}
 
-    if (strcmp(t, ":") == 0) {
+// ---------------- Public API ----------------
 
-      if (i + 1 >= count) {
-        fprintf(stderr, "expected name after :\n");
-        exit(1);
-      }
-      i++;
-      strncpy(cs.name, tokens[i], sizeof(cs.name) - 1);
-      cs.name[sizeof(cs.name) - 1] = '\0';
-      cs.curr = quote_new();
-      cs.compiling = true;
-      continue;
-    }
-    if (strcmp(t, "[") == 0) {
-      Quote *q = quote_new();
-      int depth = 1;
-      int j = i + 1;
-      for (; j < count; j++) {
-        if (strcmp(tokens[j], "[") == 0)
-          depth++;
-        else if (strcmp(tokens[j], "]") == 0) {
-          depth--;
-          if (depth == 0)
-            break;
-        }
-        quote_add_token(q, tokens[j]);
-      }
-      if (depth != 0) {
-        fprintf(stderr, "unclosed quote [ ... ]\n");
-        exit(1);
-      }
-      i = j;
-      push(&ctx->ds, VQuote(q));
-      continue;
-    }
-    if (strcmp(t, "]") == 0) {
-      fprintf(stderr, "unexpected ]\n");
-      exit(1);
-    }
-    if (is_number(t)) {
-      long long v = strtoll(t, NULL, 0);
-      push(&ctx->ds, VInt(v));
-      continue;
-    }
+static Context *context_new(uv_loop_t *loop, Dict *base) {
+  Context *ctx = (Context *)xcalloc(1, sizeof(Context));
+  stack_init(&ctx->ds);
+  stack_init(&ctx->rs);
+  ctx->dict = dict_new(base);
+  ctx->loop = loop;
+  ctx->running = true;
+  return ctx;
+}
 
-    Word *w = dict_lookup(ctx->dict, t);
-    if (w) {
-      exec_word(ctx, w);
-      continue;
-    }
+SfContext *sf_context_new(uv_loop_t *loop) {
+  return context_new(loop ? loop : uv_default_loop(), NULL);
+}
 
-    if (strncmp(t, "#S:", 3) == 0) {
-      push(&ctx->ds, VStr(t + 3));
-      continue;
-    }
+SfContext *sf_context_new_overlay(SfContext *base) {
+  return context_new(base->loop, base->dict);
+}
 
-    if (strncmp(t, "#Q:", 3) == 0) {
-      void *ptr = NULL;
-      sscanf(t + 3, "%p", &ptr);
-      push(&ctx->ds, VQuote((Quote *)ptr));
-      continue;
-    }
+void sf_context_free(SfContext *ctx) {
+  if (!ctx)
+    return;
+  // Detach first: close callbacks may run long after the context is gone.
+  Handle *h = ctx->handles;
+  while (h) {
+    Handle *next = h->next;
+    if (h->io)
+      uring_detach(ctx, h);
+    h->ctx = NULL;
+    if (h->arena)
+      h->arena->ctx = NULL;
+    ring_unlink(h->ring); // the process may exit before it is closed
+    h->prev = h->next = NULL;
+    if (!uv_is_closing(&h->u.base))
+      uv_close(&h->u.base, on_close_free);
+    h = next;
+  }
+  stack_free(ctx, &ctx->ds);
+  stack_free(ctx, &ctx->rs);
+  retired_flush(ctx);
+  free(ctx->retired);
+  free(ctx->active);
+  log_free(ctx);
+  if (ctx->lag_timer)
+    uv_close((uv_handle_t *)ctx->lag_timer, free_on_close);
+  if (ctx->batch_check)
+    uv_close((uv_handle_t *)ctx->batch_check, free_on_close);
+  if (ctx->watch_retry)
+    uv_close((uv_handle_t *)ctx->watch_retry, free_on_close);
+  worker_free(ctx);
+  uring_free(ctx);
+  writer_release(ctx->stdout_w);
+  writer_release(ctx->stderr_w);
+  dict_release(ctx->dict);
+  if (ctx->sim) {
+    free(ctx->sim->q);
+    free(ctx->sim);
+  }
+  free(ctx);
+}
+
+uv_loop_t *sf_context_loop(SfContext *ctx) { return ctx->loop; }
+
+int sf_eval(SfContext *ctx, const char *src) {
+  TokStream ts = {0};
+  ts_init(&ts);
+  scan_tokens(src, &ts);
+  int rc = run_stream(ctx, &ts);
+  ts_free(&ts);
+  return rc;
+}
 
-    fprintf(stderr, "unknown word: %s\n", t);
-    exit(1);
+int sf_eval_file(SfContext *ctx, const char *path) {
+  char *buf = read_file(path);
+  if (!buf) {
+    ctx->err = SF_ERR_IO;
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "cannot read %s", path);
+    return SF_ERR_IO;
   }
+  int rc = sf_eval(ctx, buf);
+  free(buf);
+  return rc;
 }
 
-static void add_core_words(Context *ctx) {
+const char *sf_error(SfContext *ctx) { return ctx->errmsg; }
 
-  dict_add_prim(ctx->dict, "dup", prim_dup, false);
-  dict_add_prim(ctx->dict, "drop", prim_drop, false);
-  dict_add_prim(ctx->dict, "cr", prim_cr, false);
-  dict_add_prim(ctx->dict, "print", prim_print, false);
-  dict_add_prim(ctx->dict, "bye", prim_bye, false);
-  dict_add_prim(ctx->dict, "words", prim_words, false);
+void sf_set_error_handler(SfContext *ctx, SfErrorFn fn, void *data) {
+  ctx->on_error = fn;
+  ctx->on_error_data = data;
+}
+
+void sf_set_output(SfContext *ctx, SfOutputFn fn, void *data) {
+  ctx->out = fn;
+  ctx->out_data = data;
+}
 
-  dict_add_prim(ctx->dict, "uv:run", prim_uv_run, false);
-  dict_add_prim(ctx->dict, "uv:timer", prim_uv_timer, false);
-  dict_add_prim(ctx->dict, "uv:timer-start", prim_uv_timer_start, false);
-  dict_add_prim(ctx->dict, "uv:timer-stop", prim_uv_timer_stop, false);
-  dict_add_prim(ctx->dict, "uv:close", prim_uv_close, false);
+bool sf_running(SfContext *ctx) { return ctx->running; }
 
-  dict_add_prim(ctx->dict, "uv:tcp", prim_uv_tcp, false);
-  dict_add_prim(ctx->dict, "uv:tcp-bind", prim_uv_tcp_bind, false);
-  dict_add_prim(ctx->dict, "uv:listen", prim_uv_listen, false);
-  dict_add_prim(ctx->dict, "uv:read-start", prim_uv_read_start, false);
-  dict_add_prim(ctx->dict, "uv:tcp-connect", prim_uv_tcp_connect, false);
-  dict_add_prim(ctx->dict, "uv:write", prim_uv_write, false);
+int sf_register_prim(SfContext *ctx, const char *name, SfPrimFn fn) {
+  dict_add_prim(ctx->dict, name, fn, false);
+  return SF_OK;
 }
 
-// Run a token stream through the interpreter once.
-static void run_stream(Context *ctx, TokStream *ts) {
-  exec_tokens(ctx, ts->toks, ts->count);
+int sf_depth(SfContext *ctx) { return ctx->ds.top - ctx->ds.floor; }
+
+void sf_push_int(SfContext *ctx, int64_t v) { push(&ctx->ds, VInt(v)); }
+
+void sf_push_str(SfContext *ctx, const char *s) {
+  push(&ctx->ds, VStr(ctx, s));
 }
 
-// A tiny prompt-loop for interactive exploration when no scripts are given.
-static void repl(Context *ctx) {
-  char *line = NULL;
-  size_t n = 0;
-  while (ctx->running) {
-    printf("> ");
-    fflush(stdout);
-    ssize_t r = getline(&line, &n, stdin);
-    if (r <= 0)
-      break;
-    TokStream ts = {0};
-    ts_init(&ts);
-    scan_tokens(line, &ts);
-    run_stream(ctx, &ts);
-    ts_free(&ts);
-  }
-  free(line);
-}
-
-int main(int argc, char **argv) {
-  Context ctx = {0};
-  stack_init(&ctx.ds);
-  stack_init(&ctx.rs);
-  ctx.dict = dict_new();
-  ctx.loop = uv_default_loop();
-  ctx.running = true;
-  add_core_words(&ctx);
-
-  if (argc > 1) {
-    for (int i = 1; i < argc; i++) {
-      char *buf = read_file(argv[i]);
-      if (!buf) {
-        fprintf(stderr, "cannot read %s\n", argv[i]);
-        return 1;
-      }
-      TokStream ts = {0};
-      ts_init(&ts);
-      scan_tokens(buf, &ts);
-      run_stream(&ctx, &ts);
-      ts_free(&ts);
-      free(buf);
+// The public pops report errors instead of raising them, so hosts can call
+// them outside of a primitive. A mistyped value is left on the stack.
+int sf_pop_int(SfContext *ctx, int64_t *out) {
+  if (ctx->ds.top <= ctx->ds.floor)
+    return SF_ERR_UNDERFLOW;
+  if (ctx->ds.data[ctx->ds.top - 1].type != VAL_INT)
+    return SF_ERR_TYPE;
+  *out = ctx->ds.data[--ctx->ds.top].as.i;
+  return SF_OK;
+}
+
+int sf_pop_str(SfContext *ctx, char **out) {
+  if (ctx->ds.top <= ctx->ds.floor)
+    return SF_ERR_UNDERFLOW;
+  if (ctx->ds.data[ctx->ds.top - 1].type != VAL_STRING)
+    return SF_ERR_TYPE;
+  char *s = ctx->ds.data[--ctx->ds.top].as.s;
+  *out = xstrdup(s);
+  str_free(ctx, s);
+  return SF_OK;
+}
+
+void sf_fail(SfContext *ctx, int status, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  vfail(ctx, status, fmt, ap);
+}
+
+void sf_set_limits(SfContext *ctx, const SfLimits *limits) {
+  ctx->limits = *limits;
+}
+
+void sf_stats(SfContext *ctx, SfStats *out) {
+  out->bytes = mem_total(ctx);
+  out->peak_bytes = ctx->mem_peak;
+  out->cpu_ns = meter_now(ctx);
+  out->handles = ctx->nhandles;
+  out->log_records = ctx->log ? ctx->log->records : 0;
+  out->log_dropped = ctx->log ? ctx->log->dropped : 0;
+  out->loop_lag_ms = ctx->lag_ms;
+  out->conn_rejected = ctx->conn_rejected;
+  out->stack_reclaimed = ctx->reclaimed;
+  out->out_dropped = 0;
+  if (ctx->stdout_w)
+    out->out_dropped += ctx->stdout_w->dropped;
+  if (ctx->stderr_w)
+    out->out_dropped += ctx->stderr_w->dropped;
+}
+
+int sf_use_io_uring(SfContext *ctx) {
+  const char *why = uring_open(ctx);
+  if (!why)
+    return SF_OK;
+  ctx->err = SF_ERR_UV;
+  snprintf(ctx->errmsg, sizeof(ctx->errmsg), "io_uring: %s", why);
+  return SF_ERR_UV;
+}
+
+int sf_worker_attach(SfContext *ctx, int fd) {
+  if (ctx->worker || ctx->sim) {
+    ctx->err = SF_ERR_HOST;
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "worker: %s",
+             ctx->sim ? "not available in simulation" : "already attached");
+    return SF_ERR_HOST;
+  }
+  Worker *w = (Worker *)xcalloc(1, sizeof(Worker));
+  int rc = uv_loop_init(&w->loop);
+  if (rc == 0) {
+    uv_pipe_init(&w->loop, &w->ipc, 1);
+    w->ipc.data = w;
+    rc = uv_pipe_open(&w->ipc, fd);
+    if (rc) {
+      uv_close((uv_handle_t *)&w->ipc, NULL);
+      uv_run(&w->loop, UV_RUN_DEFAULT);
+      uv_loop_close(&w->loop);
     }
+  }
+  if (rc) {
+    free(w);
+    ctx->err = SF_ERR_UV;
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "worker: %s", uv_strerror(rc));
+    return SF_ERR_UV;
+  }
+  ctx->worker = w;
+  uv_timer_init(ctx->loop, &w->report);
+  w->report.data = ctx;
+  uv_timer_start(&w->report, on_worker_report, WORKER_REPORT_MS,
+                 WORKER_REPORT_MS);
+  uv_unref((uv_handle_t *)&w->report);
+  return SF_OK;
+}
+
+int sf_run(SfContext *ctx) {
+  jmp_buf trap;
+  jmp_buf *outer = ctx->trap;
+  volatile int rc = SF_OK;
+  ctx->trap = &trap;
+  if (setjmp(trap) == 0)
+    prim_uv_run(ctx);
+  else
+    rc = ctx->err;
+  ctx->trap = outer;
+  if (!outer)
+    retired_flush(ctx);
+  return rc;
+}
+
+int sf_repl_stdio(SfContext *ctx) {
+  uv_handle_type t = uv_guess_handle(0);
+  const char *why = NULL;
+  if (ctx->sim)
+    why = "not available in simulation";
+  else if (t != UV_TTY && t != UV_NAMED_PIPE)
+    why = "stdin is not a terminal or pipe";
+  if (why) {
+    ctx->err = SF_ERR_UV;
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "repl: %s", why);
+    return SF_ERR_UV;
+  }
+  Handle *h = handle_new(ctx, HND_REPL);
+  int rc = t == UV_TTY ? uv_tty_init(ctx->loop, &h->u.tty, 0, 0)
+                       : uv_pipe_init(ctx->loop, &h->u.pipe, 0);
+  if (rc) {
+    handle_free(h);
   } else {
-    repl(&ctx);
+    h->u.base.data = h;
+    if (t == UV_NAMED_PIPE)
+      rc = uv_pipe_open(&h->u.pipe, 0);
+    if (!rc)
+      rc = uv_read_start(&h->u.stream, on_alloc, on_repl_read);
+    if (rc)
+      uv_close(&h->u.base, on_close_free);
+  }
+  if (rc) {
+    ctx->err = SF_ERR_UV;
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "repl: %s", uv_strerror(rc));
+    return SF_ERR_UV;
   }
+  h->repl = (Repl *)xcalloc(1, sizeof(Repl));
+  mem_charge(ctx, sizeof(Repl));
+  h->repl->local = true;
+  h->repl->tty = t == UV_TTY;
+  repl_send(h);
+  return SF_OK;
+}
+
+void sf_simulate(SfContext *ctx) {
+  if (!ctx->sim)
+    ctx->sim = (Sim *)xcalloc(1, sizeof(Sim));
+}
+
+// Host entry points run the same code as the words, inside a trap.
+static int trap_path(Context *ctx, void (*fn)(Context *, const char *),
+                     const char *path) {
+  jmp_buf trap;
+  jmp_buf *outer = ctx->trap;
+  volatile int rc = SF_OK;
+  ctx->trap = &trap;
+  if (setjmp(trap) == 0)
+    fn(ctx, path);
+  else
+    rc = ctx->err;
+  ctx->trap = outer;
+  if (!outer)
+    retired_flush(ctx);
+  return rc;
+}
+
+int sf_reload(SfContext *ctx, const char *path) {
+  return trap_path(ctx, reload_path, path);
+}
+
+static void watch_path_void(Context *ctx, const char *path) {
+  watch_path(ctx, path);
+}
 
-  stack_free(&ctx.ds);
-  stack_free(&ctx.rs);
-  return 0;
+int sf_watch(SfContext *ctx, const char *path) {
+  return trap_path(ctx, watch_path_void, path);
 }
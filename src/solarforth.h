@@ -0,0 +1,192 @@
+/*
+libsolarforth: the interpreter as an embeddable library
+
+A context owns its stacks, dictionary and handles, and schedules all of its
+timers and sockets on the loop it was created with. Nothing is global, so a
+host can run any number of contexts on its own loop.
+
+Errors never exit the process. sf_eval and friends return an SfStatus and
+leave a message in sf_error(). Errors raised by quotes running from libuv
+callbacks go to the handler set with sf_set_error_handler; without one, an
+error inside `uv:run` makes that word fail (and so the sf_eval that called
+it), and anywhere else it is printed to stderr.
+
+Only running out of memory is still fatal.
+*/
+
+#ifndef SOLARFORTH_H
+#define SOLARFORTH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <uv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct SfContext SfContext;
+
+typedef enum {
+  SF_OK = 0,
+  SF_ERR_UNDERFLOW,    // data stack was empty
+  SF_ERR_TYPE,         // value of the wrong type (or handle kind)
+  SF_ERR_UNKNOWN_WORD, // name not in the dictionary
+  SF_ERR_SYNTAX,       // unclosed or stray [ ], missing name after :
+  SF_ERR_IO,           // a script file could not be read
+  SF_ERR_UV,           // a libuv call failed
+  SF_ERR_HOST,         // raised by a host primitive via sf_fail
+  SF_ERR_NATIVE,       // load-native could not load or initialize a module
+  SF_ERR_LIMIT,        // the context went over an SfLimits bound
+} SfStatus;
+
+// A primitive pops its arguments from and pushes its results to the data
+// stack of the context it is called with.
+typedef void (*SfPrimFn)(SfContext *ctx);
+
+// Called for every error raised by a quote running from a libuv callback.
+typedef void (*SfErrorFn)(SfContext *ctx, int status, const char *msg,
+                          void *data);
+
+// Receives everything the context's words print.
+typedef void (*SfOutputFn)(SfContext *ctx, const char *data, size_t len,
+                           void *userdata);
+
+// Create a context on `loop` (NULL selects uv_default_loop()).
+SfContext *sf_context_new(uv_loop_t *loop);
+// Create a context on the same loop whose dictionary overlays `base`'s:
+// it sees every word defined in or registered with `base`, while its own
+// definitions stay private. Built-in words are one static table shared by
+// all contexts. `base` may be freed first; its words live on until the
+// last overlay is gone.
+SfContext *sf_context_new_overlay(SfContext *base);
+// Close every handle the context still owns and free it. The handles finish
+// closing on the next turn of the loop; no callback runs scripts after this.
+void sf_context_free(SfContext *ctx);
+uv_loop_t *sf_context_loop(SfContext *ctx);
+
+// Interpret source text, or the contents of a file.
+int sf_eval(SfContext *ctx, const char *src);
+int sf_eval_file(SfContext *ctx, const char *path);
+// Recompile the colon definitions in a script, swapping new bodies into
+// existing words; the rest of the file is not run (see `reload`).
+int sf_reload(SfContext *ctx, const char *path);
+// Reload a script whenever it changes on disk, using a uv_fs_event handle
+// owned by the context. Reload errors go to the error handler (or stderr).
+int sf_watch(SfContext *ctx, const char *path);
+// Message for the most recent error.
+const char *sf_error(SfContext *ctx);
+void sf_set_error_handler(SfContext *ctx, SfErrorFn fn, void *data);
+// Send print, cr and the other printing words to `fn` instead of stdout
+// (NULL restores stdout).
+void sf_set_output(SfContext *ctx, SfOutputFn fn, void *data);
+// False once a script has called `bye`.
+bool sf_running(SfContext *ctx);
+
+// Run the loop as `uv:run` does, for hosts that let the context drive it;
+// `uv:run` inside it is then a no-op. Returns a callback's error if one
+// stopped the loop (only without an error handler).
+int sf_run(SfContext *ctx);
+// Start an interactive session on stdin, read through a tty or pipe handle
+// on the context's loop, so lines are evaluated between events while
+// sf_run (or the host) drives it. Output goes to the context's sink and
+// errors to stderr. End of input on a terminal acts like `bye`; on a pipe
+// the loop runs on until its other handles are done. Fails when stdin is a
+// regular file or the context is simulated.
+int sf_repl_stdio(SfContext *ctx);
+
+// Accept, receive and send on an io_uring for TCP listeners and the
+// connections they accept, rather than libuv's epoll path; scripts see no
+// difference. Needs Linux 6.0 or later: otherwise it fails, and the context
+// goes on using libuv. Call it before the listeners start.
+int sf_use_io_uring(SfContext *ctx);
+
+// Run as a worker of a `solarforth --workers` master connected through the
+// IPC pipe `fd`: uv:tcp-bind then takes its listening socket from the
+// master, which shares one socket per address among all workers, and the
+// context reports its sf_stats to the master once a second.
+int sf_worker_attach(SfContext *ctx, int fd);
+
+// Add (or shadow) a word implemented in C.
+int sf_register_prim(SfContext *ctx, const char *name, SfPrimFn fn);
+
+// Data stack access for hosts and primitives. Popped strings belong to the
+// caller and are released with free().
+int sf_depth(SfContext *ctx);
+void sf_push_int(SfContext *ctx, int64_t v);
+void sf_push_str(SfContext *ctx, const char *s);
+int sf_pop_int(SfContext *ctx, int64_t *out);
+int sf_pop_str(SfContext *ctx, char **out);
+
+// Per-context resource bounds; 0 means unlimited. Memory covers the stacks,
+// strings, definitions, handles and I/O buffers the context holds. CPU is
+// loop-thread time spent running the context's code (evaluation and
+// callbacks, not time blocked in uv:run). Both are checked as tokens run:
+// going over fails the current evaluation with SF_ERR_LIMIT, and so will
+// every later one while the context stays over.
+typedef struct SfLimits {
+  size_t max_bytes;
+  uint64_t max_cpu_ns;
+} SfLimits;
+
+typedef struct SfStats {
+  size_t bytes;             // currently accounted memory
+  size_t peak_bytes;        // high-water mark, as last observed
+  uint64_t cpu_ns;          // total time spent running this context
+  uint32_t handles;         // live libuv handles
+  uint64_t out_dropped;     // stdout/stderr bytes dropped by a full buffer
+  uint64_t log_records;     // log:* records written to the ring
+  uint64_t log_dropped;     // ... and dropped because it was full
+  uint32_t loop_lag_ms;     // measured loop lag (with uv:listen-shed only)
+  uint64_t conn_rejected;   // connections closed by uv:listen-limit or -shed
+  uint64_t stack_reclaimed; // values callbacks left on the data stack
+} SfStats;
+
+// Switch to simulation: timers run on a virtual clock that uv:run advances
+// straight to the next deadline, and TCP handles become in-memory loopback
+// streams between this context's listeners and clients. Call it before the
+// context creates any handle.
+void sf_simulate(SfContext *ctx);
+
+void sf_set_limits(SfContext *ctx, const SfLimits *limits);
+void sf_stats(SfContext *ctx, SfStats *out);
+
+// Abort the running primitive with an error. Only valid inside a primitive;
+// the surrounding sf_eval (or callback) reports `status` and the message.
+void sf_fail(SfContext *ctx, int status, const char *fmt, ...)
+#if defined(__GNUC__)
+    __attribute__((noreturn, format(printf, 3, 4)))
+#endif
+    ;
+
+// ---- Native extension modules ----
+// `load-native ( path -- )` dlopens a shared object and calls its
+// SF_NATIVE_INIT entry point with a table of the functions above, so a
+// module needs no link-time dependency on the interpreter. The table only
+// ever grows at the end: check `abi` and `size` before using newer members.
+// Modules stay loaded for the life of the process.
+#define SF_NATIVE_ABI 1
+#define SF_NATIVE_INIT "sf_native_init"
+
+typedef struct SfNativeApi {
+  uint32_t abi;  // SF_NATIVE_ABI of the host
+  uint32_t size; // sizeof(SfNativeApi) in the host
+  int (*register_prim)(SfContext *ctx, const char *name, SfPrimFn fn);
+  int (*depth)(SfContext *ctx);
+  void (*push_int)(SfContext *ctx, int64_t v);
+  void (*push_str)(SfContext *ctx, const char *s);
+  int (*pop_int)(SfContext *ctx, int64_t *out);
+  int (*pop_str)(SfContext *ctx, char **out);
+  void (*fail)(SfContext *ctx, int status, const char *fmt, ...);
+  uv_loop_t *(*loop)(SfContext *ctx);
+} SfNativeApi;
+
+// Signature of the entry point; return SF_OK or an SfStatus code.
+typedef int (*SfNativeInitFn)(SfContext *ctx, const SfNativeApi *api);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,145 @@
+#!/usr/bin/env bash
+# Behaviour checks that need real sockets, descriptors or processes.
+#
+#   tests/run.sh [BIN]
+#
+# Each check runs scripts from tests/ and looks at what they print. Checks
+# for features the kernel lacks are skipped. Exits non-zero if any failed.
+set -u
+
+bin=${1:-./solarforth}
+case $bin in
+*/*) bin=$(cd "$(dirname "$bin")" && pwd)/$(basename "$bin") ;;
+esac
+dir=$(cd "$(dirname "$0")" && pwd)
+failed=0
+
+# check NAME: run check_NAME; status 0 passes, 2 skips, anything else fails.
+check() {
+  local out rc
+  out=$("check_$1" 2>&1)
+  rc=$?
+  if [ "$rc" -eq 0 ]; then
+    printf 'ok   %s\n' "$1"
+  elif [ "$rc" -eq 2 ]; then
+    printf 'skip %s: %s\n' "$1" "$out"
+  else
+    printf 'FAIL %s\n%s\n' "$1" "$out"
+    failed=$((failed + 1))
+  fi
+}
+
+# The value after KEY in a `stats` or `handles` line.
+stat() {
+  sed -n "s/.* $1 \([0-9]*\).*/\1/p" "$2"
+}
+
+# An io_uring listener kept out of descriptors for most of a second: its
+# accepts fail with EMFILE, and must be retried later rather than at once,
+# which would spin. Once the clients are gone it serves again.
+check_emfile() {
+  local out cpu n
+  out=$(mktemp)
+  (
+    ulimit -n 14
+    TIMEFORMAT='cpu %U %S'
+    time "$bin" --io-uring "$dir/emfile_server.frt"
+  ) >"$out" 2>&1 &
+  local server=$!
+  sleep 0.2
+  "$bin" "$dir/emfile_clients.frt" >/dev/null
+  n=$("$bin" "$dir/emfile_probe.frt" | grep -c '^ok$')
+  wait "$server"
+  if grep -q 'using libuv' "$out"; then
+    head -1 "$out"
+    rm -f "$out"
+    return 2
+  fi
+  cpu=$(awk '$1 == "cpu" { printf "%d", ($2 + $3) * 1000 }' "$out")
+  grep -v '^cpu ' "$out"
+  rm -f "$out"
+  echo "probe greeted $n of 1, server cpu ${cpu:-?} ms"
+  [ "$n" -eq 1 ] && [ -n "$cpu" ] && [ "$cpu" -lt 300 ]
+}
+
+# Messages through a small shm ring as it wraps, in order and complete,
+# and one too large for it refused without harm.
+check_ring() {
+  local tmp sent full
+  tmp=$(mktemp -d)
+  head -c 3000 /dev/zero | tr '\0' x >"$tmp/big.txt"
+  "$bin" "$dir/ring_reader.frt" >"$tmp/reader" 2>&1 &
+  local reader=$!
+  sleep 0.2
+  (cd "$tmp" && "$bin" "$dir/ring_writer.frt") >"$tmp/writer" 2>&1
+  wait "$reader"
+  cat "$tmp/writer"
+  grep -q 'message too large' "$tmp/writer" || return 1
+  sent=$(stat sent "$tmp/reader")
+  full=$(stat full "$tmp/reader")
+  awk -v sent="${sent:-0}" -v full="${full:-1}" '
+    BEGIN {
+      m[0] = "one"
+      m[1] = "two two two two two two two two two"
+      m[2] = "three three three three three three three three"
+    }
+    /^</ { next }
+    $0 != m[n % 3] { bad++ }
+    { n++ }
+    END {
+      printf "%d messages, %d out of place, sent %d, full %d\n", n, bad, sent,
+        full
+      exit !(n >= 300 && n % 3 == 0 && !bad && n == sent && !full)
+    }' "$tmp/reader"
+  local rc=$?
+  rm -rf "$tmp"
+  return "$rc"
+}
+
+# SIGTERM drains a server whose clients have all hung up at once, though
+# it kept their connections open; on both backends.
+check_drain() {
+  local backend n t0 ms
+  for backend in "" --io-uring; do
+    "$bin" $backend "$dir/drain_server.frt" 2>/dev/null &
+    local server=$!
+    sleep 0.2
+    n=$("$bin" "$dir/drain_clients.frt" | grep -c '^hi$')
+    t0=$(date +%s%N)
+    kill -TERM "$server"
+    wait "$server"
+    ms=$((($(date +%s%N) - t0) / 1000000))
+    echo "${backend:-libuv}: echoed $n of 4, drained in $ms ms"
+    [ "$n" -eq 4 ] && [ "$ms" -lt 2000 ] || return 1
+  done
+}
+
+# reload under uv:run frees the bodies it replaces as it goes: memory in
+# use is the same after two seconds of reloads as after half a second.
+check_reload() {
+  local out first last
+  out=$(cd "$dir" && "$bin" reload.frt 2>&1)
+  first=$(echo "$out" | sed -n '1s/^bytes \([0-9]*\).*/\1/p')
+  last=$(echo "$out" | sed -n '2s/^bytes \([0-9]*\).*/\1/p')
+  echo "bytes ${first:-?} after 0.5 s, ${last:-?} after 2 s"
+  [ -n "$first" ] && [ "$first" = "$last" ]
+}
+
+# What a connection with uv:arena reads comes from its arena, plain or
+# batched, on both backends: each shows the string it was handed as live.
+check_arena() {
+  local backend n
+  for backend in "" --io-uring; do
+    n=$("$bin" $backend "$dir/arena.frt" 2>&1 | grep -c ' arena 1/')
+    echo "${backend:-libuv}: $n of 2 reads in the arena"
+    [ "$n" -eq 2 ] || return 1
+  done
+}
+
+check emfile
+check ring
+check drain
+check reload
+check arena
+
+[ "$failed" -eq 0 ]
@@ -0,0 +1,114 @@
+/*
+genprims: build the perfect hash for the built-in words
+
+Reads the names in src/prims.def (compiled in) and prints a header with a
+hash-and-displace table: a name's bucket is prim_hash(name, 0), and each
+bucket stores the seed that sends all of its names to distinct free slots.
+A lookup is two hashes, one slot load and one strcmp, with no allocation.
+
+  genprims > build/prims.gen.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prim_hash.h"
+
+static const char *names[] = {
+#define PRIM(name, fn) name,
+#include "prims.def"
+#undef PRIM
+};
+
+enum { COUNT = sizeof(names) / sizeof(names[0]) };
+
+static uint32_t pow2_at_least(uint32_t n) {
+  uint32_t p = 1;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+int main(void) {
+  for (int i = 0; i < COUNT; i++)
+    for (int j = i + 1; j < COUNT; j++)
+      if (strcmp(names[i], names[j]) == 0) {
+        fprintf(stderr, "genprims: duplicate word %s\n", names[i]);
+        return 1;
+      }
+
+  uint32_t nslots = pow2_at_least(2 * COUNT);
+  uint32_t nbuckets = pow2_at_least(COUNT / 2 > 0 ? COUNT / 2 : 1);
+  int *bucket_of = calloc(COUNT, sizeof(int));
+  int *bucket_size = calloc(nbuckets, sizeof(int));
+  int *order = calloc(nbuckets, sizeof(int));
+  uint32_t *disp = calloc(nbuckets, sizeof(uint32_t));
+  int *slots = malloc(nslots * sizeof(int));
+  uint32_t *tried = calloc(COUNT, sizeof(uint32_t));
+  if (!bucket_of || !bucket_size || !order || !disp || !slots || !tried) {
+    fprintf(stderr, "genprims: out of memory\n");
+    return 1;
+  }
+  for (uint32_t s = 0; s < nslots; s++)
+    slots[s] = -1;
+  for (int i = 0; i < COUNT; i++) {
+    bucket_of[i] = (int)(prim_hash(names[i], 0) & (nbuckets - 1));
+    bucket_size[bucket_of[i]]++;
+  }
+
+  // Place the fullest buckets first, while most slots are still free.
+  for (uint32_t b = 0; b < nbuckets; b++)
+    order[b] = (int)b;
+  for (uint32_t a = 0; a < nbuckets; a++)
+    for (uint32_t b = a + 1; b < nbuckets; b++)
+      if (bucket_size[order[b]] > bucket_size[order[a]]) {
+        int t = order[a];
+        order[a] = order[b];
+        order[b] = t;
+      }
+
+  for (uint32_t k = 0; k < nbuckets && bucket_size[order[k]] > 0; k++) {
+    int b = order[k];
+    uint32_t seed = 1;
+    for (;; seed++) {
+      if (seed > 10000000u) {
+        fprintf(stderr, "genprims: no seed for bucket %d\n", b);
+        return 1;
+      }
+      int n = 0;
+      int ok = 1;
+      for (int i = 0; i < COUNT && ok; i++) {
+        if (bucket_of[i] != b)
+          continue;
+        uint32_t s = prim_hash(names[i], seed) & (nslots - 1);
+        if (slots[s] != -1)
+          ok = 0;
+        for (int j = 0; j < n && ok; j++)
+          if (tried[j] == s)
+            ok = 0;
+        tried[n++] = s;
+      }
+      if (ok)
+        break;
+    }
+    disp[b] = seed;
+    for (int i = 0; i < COUNT; i++)
+      if (bucket_of[i] == b)
+        slots[prim_hash(names[i], seed) & (nslots - 1)] = i;
+  }
+
+  printf("/* Generated by tools/genprims.c from src/prims.def; do not edit. */\n\n");
+  printf("#define PRIM_COUNT %d\n", COUNT);
+  printf("#define PRIM_BUCKET_MASK %uu\n", nbuckets - 1);
+  printf("#define PRIM_SLOT_MASK %uu\n\n", nslots - 1);
+  printf("static const uint32_t prim_disp[%u] = {", nbuckets);
+  for (uint32_t b = 0; b < nbuckets; b++)
+    printf("%s%u", b ? ", " : "", disp[b]);
+  printf("};\n\n");
+  printf("static const int16_t prim_slots[%u] = {", nslots);
+  for (uint32_t s = 0; s < nslots; s++)
+    printf("%s%s%d", s ? "," : "", s % 16 ? " " : "\n    ", slots[s]);
+  printf("\n};\n");
+  return 0;
+}